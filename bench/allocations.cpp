@@ -0,0 +1,61 @@
+#include "allocations.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+// Trivially initialized, so operator new may use them on any thread at any time
+static thread_local size_t allocations = 0;
+static thread_local size_t allocated_bytes = 0;
+
+size_t ThreadAllocations() {
+    return allocations;
+}
+
+size_t ThreadAllocatedBytes() {
+    return allocated_bytes;
+}
+
+int MaxBenchmarkThreads() {
+    return std::max(2, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+// The array and nothrow forms of the standard library call these
+
+void* operator new(size_t size) {
+    ++allocations;
+    allocated_bytes += size;
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+    ++allocations;
+    allocated_bytes += size;
+    auto alignment = static_cast<size_t>(align);
+    // aligned_alloc wants a multiple of the alignment
+    size_t rounded = (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment;
+    if (void* ptr = std::aligned_alloc(alignment, rounded)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
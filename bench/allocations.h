@@ -0,0 +1,51 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <string>
+
+// Heap traffic of the calling thread, counted by the global operator new of allocations.cpp.
+// The counters are thread_local, so counting adds no sharing between benchmark threads.
+size_t ThreadAllocations();
+size_t ThreadAllocatedBytes();
+
+// Reports the allocations and bytes per iteration made between its construction and its
+// destruction, put around the benchmark loop:
+//
+// AllocationReport report(state);
+// for (auto _ : state) { ... }
+//
+// Counts from all threads of a benchmark are summed and divided by the total iterations. Memory
+// freed on another thread is not subtracted: these are allocations, not the live size.
+class AllocationReport {
+public:
+    explicit AllocationReport(benchmark::State& state)
+        : state_(state), allocations_(ThreadAllocations()), bytes_(ThreadAllocatedBytes()) {
+    }
+
+    AllocationReport(const AllocationReport&) = delete;
+    AllocationReport& operator=(const AllocationReport&) = delete;
+
+    ~AllocationReport() {
+        state_.counters["allocs/op"] = benchmark::Counter(
+            static_cast<double>(ThreadAllocations() - allocations_),
+            benchmark::Counter::kAvgIterations);
+        state_.counters["bytes/op"] = benchmark::Counter(
+            static_cast<double>(ThreadAllocatedBytes() - bytes_),
+            benchmark::Counter::kAvgIterations);
+    }
+
+private:
+    benchmark::State& state_;
+    size_t allocations_;
+    size_t bytes_;
+};
+
+// Thread counts for the contended benchmarks: powers of two up to the hardware threads, and at
+// least two, so that there is some contention to see on small machines too
+int MaxBenchmarkThreads();
+
+// Puts `sizeof(type) = N` into the context printed before the results
+#define REPORT_SIZEOF(...) benchmark::AddCustomContext("sizeof(" #__VA_ARGS__ ")", \
+                                                       std::to_string(sizeof(__VA_ARGS__)))
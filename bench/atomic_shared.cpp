@@ -0,0 +1,127 @@
+// AtomicSharedPtr under contention: all threads load one cell, and with a nonzero argument every
+// n-th operation of each thread stores a new object instead. Compared with a SharedPtr behind a
+// mutex and with the std::atomic_load/atomic_store overloads for std::shared_ptr.
+
+#include "allocations.h"
+#include "families.h"
+
+#include "shared-from-this/atomic_shared.h"
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <mutex>
+
+class MutexCell {
+public:
+    using Pointer = SharedPtr<Payload>;
+
+    static Pointer Make(int64_t value) {
+        return MakeShared<Payload>(value);
+    }
+
+    Pointer Load() const {
+        std::lock_guard guard(mutex_);
+        return value_;
+    }
+
+    // The old value is released after unlocking
+    void Store(Pointer value) {
+        std::lock_guard guard(mutex_);
+        value_.Swap(value);
+    }
+
+private:
+    mutable std::mutex mutex_;
+    Pointer value_;
+};
+
+class LockFreeCell {
+public:
+    using Pointer = SharedPtr<Payload>;
+
+    static Pointer Make(int64_t value) {
+        return MakeShared<Payload>(value);
+    }
+
+    Pointer Load() const {
+        return cell_.Load();
+    }
+
+    void Store(Pointer value) {
+        cell_.Store(std::move(value));
+    }
+
+private:
+    AtomicSharedPtr<Payload> cell_;
+};
+
+class StdCell {
+public:
+    using Pointer = std::shared_ptr<Payload>;
+
+    static Pointer Make(int64_t value) {
+        return std::make_shared<Payload>(value);
+    }
+
+    Pointer Load() const {
+        return std::atomic_load(&value_);
+    }
+
+    void Store(Pointer value) {
+        std::atomic_store(&value_, std::move(value));
+    }
+
+private:
+    Pointer value_;
+};
+
+template <typename Cell>
+static void LoadStore(benchmark::State& state) {
+    static Cell cell;
+    int64_t store_every = state.range(0);
+    if (state.thread_index() == 0) {
+        cell.Store(Cell::Make(0));
+    }
+    int64_t count = 0;
+    AllocationReport report(state);
+    for (auto _ : state) {
+        if (store_every && ++count == store_every) {
+            count = 0;
+            cell.Store(Cell::Make(state.thread_index()));
+        } else {
+            auto value = cell.Load();
+            benchmark::DoNotOptimize(value->first);
+        }
+    }
+    if (state.thread_index() == 0) {
+        cell.Store(nullptr);
+    }
+}
+
+// Loads only, then one store in 16 and in 2 operations
+#define CELL_BENCHMARK(Cell)                                                                   \
+    BENCHMARK_TEMPLATE(LoadStore, Cell)                                                        \
+        ->Arg(0)                                                                               \
+        ->Arg(16)                                                                              \
+        ->Arg(2)                                                                               \
+        ->ThreadRange(1, MaxBenchmarkThreads())                                                \
+        ->UseRealTime()
+
+CELL_BENCHMARK(LockFreeCell);
+CELL_BENCHMARK(MutexCell);
+CELL_BENCHMARK(StdCell);
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    REPORT_SIZEOF(AtomicSharedPtr<Payload>);
+    REPORT_SIZEOF(MutexCell);
+    benchmark::AddCustomContext("AtomicSharedPtr<Payload>::IsLockFree()",
+                                AtomicSharedPtr<Payload>().IsLockFree() ? "true" : "false");
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
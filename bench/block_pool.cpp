@@ -0,0 +1,109 @@
+// Allocation rate of BlockPool against glibc malloc, for sizes of control blocks. The pool is
+// called directly here; bench_pointers shows it inside MakeShared and SharedPtr(new T).
+
+#include "allocations.h"
+
+#include "shared-from-this/block_pool.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+struct Pool {
+    static void* Allocate(size_t size) {
+        return BlockPool::Allocate(size);
+    }
+
+    static void Deallocate(void* ptr, size_t size) {
+        BlockPool::Deallocate(ptr, size);
+    }
+};
+
+struct Malloc {
+    static void* Allocate(size_t size) {
+        return std::malloc(size);
+    }
+
+    static void Deallocate(void* ptr, size_t) {
+        std::free(ptr);
+    }
+};
+
+// One block at a time: the free list (or tcache) hit
+template <typename Allocator>
+static void AllocateFree(benchmark::State& state) {
+    size_t size = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        void* ptr = Allocator::Allocate(size);
+        benchmark::DoNotOptimize(ptr);
+        Allocator::Deallocate(ptr, size);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(AllocateFree, Pool)
+    ->Arg(32)
+    ->Arg(64)
+    ->Arg(128)
+    ->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(AllocateFree, Malloc)
+    ->Arg(32)
+    ->Arg(64)
+    ->Arg(128)
+    ->ThreadRange(1, MaxBenchmarkThreads());
+
+// Many live blocks, freed in a shuffled order, as when a container of pointers goes away
+template <typename Allocator>
+static void AllocateMany(benchmark::State& state) {
+    constexpr size_t kSize = 48;
+    constexpr size_t kCount = 4096;
+    std::vector<void*> blocks(kCount);
+    std::vector<size_t> order(kCount);
+    for (size_t i = 0; i < kCount; ++i) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937(42));
+    for (auto _ : state) {
+        for (auto& block : blocks) {
+            block = Allocator::Allocate(kSize);
+        }
+        benchmark::DoNotOptimize(blocks.data());
+        for (size_t index : order) {
+            Allocator::Deallocate(blocks[index], kSize);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kCount);
+}
+BENCHMARK_TEMPLATE(AllocateMany, Pool)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(AllocateMany, Malloc)->ThreadRange(1, MaxBenchmarkThreads());
+
+// Every block goes into a slot shared by all threads, and whatever was in the slot is freed: with
+// more than one thread most blocks are freed by a thread other than the one that allocated them
+template <typename Allocator>
+static void RemoteFree(benchmark::State& state) {
+    constexpr size_t kSize = 48;
+    constexpr size_t kSlots = 4096;
+    static std::atomic<void*> slots[kSlots];
+    std::minstd_rand random(state.thread_index() + 1);
+    for (auto _ : state) {
+        void* old = slots[random() % kSlots].exchange(Allocator::Allocate(kSize));
+        if (old) {
+            Allocator::Deallocate(old, kSize);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        for (auto& slot : slots) {
+            if (void* old = slot.exchange(nullptr)) {
+                Allocator::Deallocate(old, kSize);
+            }
+        }
+    }
+}
+BENCHMARK_TEMPLATE(RemoteFree, Pool)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(RemoteFree, Malloc)->ThreadRange(1, MaxBenchmarkThreads());
+
+BENCHMARK_MAIN();
@@ -0,0 +1,57 @@
+// False sharing between the counts and the object: thread 0 writes the object while the other
+// threads copy the pointer to it. With MakeShared the object shares a cache line with the counts
+// the copies bump, MakeSharedPadded moves it to a line of its own. Thread 0 alone is the baseline.
+
+#include "allocations.h"
+
+#include "shared-from-this/shared.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+
+struct Counter {
+    int64_t value = 0;
+};
+
+struct Plain {
+    static SharedPtr<Counter> Make() {
+        return MakeShared<Counter>();
+    }
+};
+
+struct Padded {
+    static SharedPtr<Counter> Make() {
+        return MakeSharedPadded<Counter>();
+    }
+};
+
+template <typename Maker>
+static void WriteWhileCopying(benchmark::State& state) {
+    static SharedPtr<Counter> shared;
+    if (state.thread_index() == 0) {
+        shared = Maker::Make();
+        Counter& counter = *shared;
+        for (auto _ : state) {
+            ++counter.value;
+            benchmark::ClobberMemory();
+        }
+    } else {
+        for (auto _ : state) {
+            auto copy = shared;
+            benchmark::DoNotOptimize(copy);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        shared = nullptr;
+    }
+}
+BENCHMARK_TEMPLATE(WriteWhileCopying, Plain)
+    ->ThreadRange(1, MaxBenchmarkThreads())
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(WriteWhileCopying, Padded)
+    ->ThreadRange(1, MaxBenchmarkThreads())
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
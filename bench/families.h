@@ -0,0 +1,90 @@
+#pragma once
+
+#include "shared-from-this/shared.h"
+#include "shared-from-this/weak.h"
+#include "unique/unique.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// The pointers of this repository and their std counterparts behind one interface, so that every
+// benchmark is written once and registered for both: `Copy<Ours>` next to `Copy<Std>`.
+
+struct Ours {
+    template <typename T>
+    using Shared = SharedPtr<T>;
+    template <typename T>
+    using Weak = WeakPtr<T>;
+    template <typename T>
+    using Unique = UniquePtr<T>;
+
+    template <typename T, typename... Args>
+    static Shared<T> MakeShared(Args&&... args) {
+        return ::MakeShared<T>(std::forward<Args>(args)...);
+    }
+
+    template <typename T, typename... Args>
+    static Unique<T> MakeUnique(Args&&... args) {
+        return ::MakeUnique<T>(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    static void Reset(Shared<T>& ptr, T* object) {
+        ptr.Reset(object);
+    }
+
+    template <typename T>
+    static void Reset(Unique<T>& ptr, T* object) {
+        ptr.Reset(object);
+    }
+
+    template <typename T>
+    static Shared<T> Lock(const Weak<T>& ptr) {
+        return ptr.Lock();
+    }
+};
+
+struct Std {
+    template <typename T>
+    using Shared = std::shared_ptr<T>;
+    template <typename T>
+    using Weak = std::weak_ptr<T>;
+    template <typename T>
+    using Unique = std::unique_ptr<T>;
+
+    template <typename T, typename... Args>
+    static Shared<T> MakeShared(Args&&... args) {
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+
+    template <typename T, typename... Args>
+    static Unique<T> MakeUnique(Args&&... args) {
+        return std::make_unique<T>(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    static void Reset(Shared<T>& ptr, T* object) {
+        ptr.reset(object);
+    }
+
+    template <typename T>
+    static void Reset(Unique<T>& ptr, T* object) {
+        ptr.reset(object);
+    }
+
+    template <typename T>
+    static Shared<T> Lock(const Weak<T>& ptr) {
+        return ptr.lock();
+    }
+};
+
+// A small object, about the size most benchmarks would manage
+struct Payload {
+    Payload() = default;
+    explicit Payload(int64_t value) : first(value), second(value) {
+    }
+
+    int64_t first = 0;
+    int64_t second = 0;
+};
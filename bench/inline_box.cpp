@@ -0,0 +1,124 @@
+// InlineBox against UniquePtr<Base> for small polymorphic objects: making and destroying one,
+// moving one, and calling a virtual function through a vector of them
+
+#include "allocations.h"
+
+#include "unique/inline_box.h"
+#include "unique/unique.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+struct Shape {
+    virtual ~Shape() = default;
+    virtual double Area() const = 0;
+};
+
+struct Circle : Shape {
+    explicit Circle(double radius) : radius(radius) {
+    }
+
+    double Area() const override {
+        return 3.14159 * radius * radius;
+    }
+
+    double radius;
+};
+
+struct Rectangle : Shape {
+    Rectangle(double width, double height) : width(width), height(height) {
+    }
+
+    double Area() const override {
+        return width * height;
+    }
+
+    double width, height;
+};
+
+struct Boxed {
+    using Holder = InlineBox<Shape>;
+
+    template <typename Derived, typename... Args>
+    static Holder Make(Args&&... args) {
+        return MakeInlineBox<Shape, Derived>(std::forward<Args>(args)...);
+    }
+};
+
+struct Heap {
+    using Holder = UniquePtr<Shape>;
+
+    template <typename Derived, typename... Args>
+    static Holder Make(Args&&... args) {
+        return MakeUnique<Derived>(std::forward<Args>(args)...);
+    }
+};
+
+template <typename H>
+static void MakeShape(benchmark::State& state) {
+    AllocationReport report(state);
+    for (auto _ : state) {
+        auto shape = H::template Make<Circle>(1.0);
+        benchmark::DoNotOptimize(shape);
+    }
+}
+BENCHMARK_TEMPLATE(MakeShape, Boxed);
+BENCHMARK_TEMPLATE(MakeShape, Heap);
+
+// A box moves the object itself, a UniquePtr only the pointer
+template <typename H>
+static void MoveShape(benchmark::State& state) {
+    auto first = H::template Make<Rectangle>(1.0, 2.0);
+    decltype(first) second;
+    AllocationReport report(state);
+    for (auto _ : state) {
+        second = std::move(first);
+        first = std::move(second);
+        benchmark::DoNotOptimize(first);
+    }
+}
+BENCHMARK_TEMPLATE(MoveShape, Boxed);
+BENCHMARK_TEMPLATE(MoveShape, Heap);
+
+// The shapes are shuffled once, as after sorting, so the heap objects are not visited in the
+// order they were allocated
+template <typename H>
+static void SumAreas(benchmark::State& state) {
+    size_t count = static_cast<size_t>(state.range(0));
+    std::vector<typename H::Holder> shapes;
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 2) {
+            shapes.push_back(H::template Make<Circle>(static_cast<double>(i)));
+        } else {
+            shapes.push_back(H::template Make<Rectangle>(static_cast<double>(i), 2.0));
+        }
+    }
+    std::shuffle(shapes.begin(), shapes.end(), std::mt19937(42));
+    for (auto _ : state) {
+        double sum = 0;
+        for (const auto& shape : shapes) {
+            sum += shape->Area();
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(count));
+}
+BENCHMARK_TEMPLATE(SumAreas, Boxed)->Arg(1024)->Arg(1 << 16);
+BENCHMARK_TEMPLATE(SumAreas, Heap)->Arg(1024)->Arg(1 << 16);
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    REPORT_SIZEOF(InlineBox<Shape>);
+    REPORT_SIZEOF(UniquePtr<Shape>);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
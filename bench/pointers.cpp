@@ -0,0 +1,209 @@
+// Micro benchmarks: one pointer operation per iteration, ours against std
+
+#include "allocations.h"
+#include "families.h"
+
+#include <benchmark/benchmark.h>
+
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Creation
+
+template <typename F>
+static void MakeShared(benchmark::State& state) {
+    AllocationReport report(state);
+    for (auto _ : state) {
+        auto ptr = F::template MakeShared<Payload>(1);
+        benchmark::DoNotOptimize(ptr);
+    }
+}
+BENCHMARK_TEMPLATE(MakeShared, Ours)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(MakeShared, Std)->ThreadRange(1, MaxBenchmarkThreads());
+
+// The object and the block in two allocations
+template <typename F>
+static void SharedFromNew(benchmark::State& state) {
+    AllocationReport report(state);
+    for (auto _ : state) {
+        typename F::template Shared<Payload> ptr(new Payload(1));
+        benchmark::DoNotOptimize(ptr);
+    }
+}
+BENCHMARK_TEMPLATE(SharedFromNew, Ours)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(SharedFromNew, Std)->ThreadRange(1, MaxBenchmarkThreads());
+
+template <typename F>
+static void MakeUnique(benchmark::State& state) {
+    AllocationReport report(state);
+    for (auto _ : state) {
+        auto ptr = F::template MakeUnique<Payload>(1);
+        benchmark::DoNotOptimize(ptr);
+    }
+}
+BENCHMARK_TEMPLATE(MakeUnique, Ours);
+BENCHMARK_TEMPLATE(MakeUnique, Std);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Copies and moves
+
+// Every thread copies the same pointer, so the threads contend for one count
+template <typename F>
+static void CopyShared(benchmark::State& state) {
+    static typename F::template Shared<Payload> shared;
+    if (state.thread_index() == 0) {
+        shared = F::template MakeShared<Payload>(1);
+    }
+    AllocationReport report(state);
+    for (auto _ : state) {
+        auto copy = shared;
+        benchmark::DoNotOptimize(copy);
+    }
+    if (state.thread_index() == 0) {
+        shared = nullptr;
+    }
+}
+BENCHMARK_TEMPLATE(CopyShared, Ours)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(CopyShared, Std)->ThreadRange(1, MaxBenchmarkThreads());
+
+// Each thread copies its own pointer: the count is not shared
+template <typename F>
+static void CopySharedPrivate(benchmark::State& state) {
+    auto shared = F::template MakeShared<Payload>(1);
+    AllocationReport report(state);
+    for (auto _ : state) {
+        auto copy = shared;
+        benchmark::DoNotOptimize(copy);
+    }
+}
+BENCHMARK_TEMPLATE(CopySharedPrivate, Ours)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(CopySharedPrivate, Std)->ThreadRange(1, MaxBenchmarkThreads());
+
+template <typename F>
+static void MoveShared(benchmark::State& state) {
+    auto first = F::template MakeShared<Payload>(1);
+    decltype(first) second;
+    AllocationReport report(state);
+    for (auto _ : state) {
+        second = std::move(first);
+        first = std::move(second);
+        benchmark::DoNotOptimize(first);
+    }
+}
+BENCHMARK_TEMPLATE(MoveShared, Ours);
+BENCHMARK_TEMPLATE(MoveShared, Std);
+
+template <typename F>
+static void MoveUnique(benchmark::State& state) {
+    auto first = F::template MakeUnique<Payload>(1);
+    decltype(first) second;
+    AllocationReport report(state);
+    for (auto _ : state) {
+        second = std::move(first);
+        first = std::move(second);
+        benchmark::DoNotOptimize(first);
+    }
+}
+BENCHMARK_TEMPLATE(MoveUnique, Ours);
+BENCHMARK_TEMPLATE(MoveUnique, Std);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Weak pointers
+
+// All threads lock one weak pointer to a live object
+template <typename F>
+static void LockWeak(benchmark::State& state) {
+    static typename F::template Shared<Payload> shared;
+    static typename F::template Weak<Payload> weak;
+    if (state.thread_index() == 0) {
+        shared = F::template MakeShared<Payload>(1);
+        weak = shared;
+    }
+    AllocationReport report(state);
+    for (auto _ : state) {
+        auto locked = F::Lock(weak);
+        benchmark::DoNotOptimize(locked);
+    }
+    if (state.thread_index() == 0) {
+        weak = {};
+        shared = nullptr;
+    }
+}
+BENCHMARK_TEMPLATE(LockWeak, Ours)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(LockWeak, Std)->ThreadRange(1, MaxBenchmarkThreads());
+
+template <typename F>
+static void LockExpired(benchmark::State& state) {
+    typename F::template Weak<Payload> weak = F::template MakeShared<Payload>(1);
+    AllocationReport report(state);
+    for (auto _ : state) {
+        auto locked = F::Lock(weak);
+        benchmark::DoNotOptimize(locked);
+    }
+}
+BENCHMARK_TEMPLATE(LockExpired, Ours);
+BENCHMARK_TEMPLATE(LockExpired, Std);
+
+// A weak pointer made and dropped: the weak count of a shared block
+template <typename F>
+static void CopyWeak(benchmark::State& state) {
+    static typename F::template Shared<Payload> shared;
+    if (state.thread_index() == 0) {
+        shared = F::template MakeShared<Payload>(1);
+    }
+    AllocationReport report(state);
+    for (auto _ : state) {
+        typename F::template Weak<Payload> weak = shared;
+        benchmark::DoNotOptimize(weak);
+    }
+    if (state.thread_index() == 0) {
+        shared = nullptr;
+    }
+}
+BENCHMARK_TEMPLATE(CopyWeak, Ours)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(CopyWeak, Std)->ThreadRange(1, MaxBenchmarkThreads());
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reset
+
+template <typename F>
+static void ResetShared(benchmark::State& state) {
+    typename F::template Shared<Payload> ptr;
+    AllocationReport report(state);
+    for (auto _ : state) {
+        F::Reset(ptr, new Payload(1));
+        benchmark::DoNotOptimize(ptr);
+    }
+}
+BENCHMARK_TEMPLATE(ResetShared, Ours)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(ResetShared, Std)->ThreadRange(1, MaxBenchmarkThreads());
+
+template <typename F>
+static void ResetUnique(benchmark::State& state) {
+    typename F::template Unique<Payload> ptr;
+    AllocationReport report(state);
+    for (auto _ : state) {
+        F::Reset(ptr, new Payload(1));
+        benchmark::DoNotOptimize(ptr);
+    }
+}
+BENCHMARK_TEMPLATE(ResetUnique, Ours);
+BENCHMARK_TEMPLATE(ResetUnique, Std);
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    REPORT_SIZEOF(SharedPtr<Payload>);
+    REPORT_SIZEOF(std::shared_ptr<Payload>);
+    REPORT_SIZEOF(WeakPtr<Payload>);
+    REPORT_SIZEOF(std::weak_ptr<Payload>);
+    REPORT_SIZEOF(UniquePtr<Payload>);
+    REPORT_SIZEOF(std::unique_ptr<Payload>);
+    REPORT_SIZEOF(UniquePtr<Payload, void (*)(Payload*)>);
+    REPORT_SIZEOF(std::unique_ptr<Payload, void (*)(Payload*)>);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
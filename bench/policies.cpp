@@ -0,0 +1,119 @@
+// Cost of the counting policies of SharedPtr: the same operations with every policy, single
+// threaded first, then with the threads sharing one count where the policy allows it
+
+#include "allocations.h"
+#include "families.h"
+
+#include "shared-from-this/biased.h"
+#include "shared-from-this/local.h"
+#include "shared-from-this/reclaim.h"
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+
+// DeferredRefCount only queues the objects, somebody has to destroy them
+template <typename Policy>
+static void FinishDeferred() {
+    if constexpr (std::is_same_v<Policy, DeferredRefCount>) {
+        Reclaimer::Global().Drain(std::chrono::hours(1));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Single threaded
+
+template <typename Policy>
+static void MakeSharedWith(benchmark::State& state) {
+    AllocationReport report(state);
+    for (auto _ : state) {
+        auto ptr = MakeShared<Payload, Policy>(1);
+        benchmark::DoNotOptimize(ptr);
+    }
+    FinishDeferred<Policy>();
+}
+BENCHMARK_TEMPLATE(MakeSharedWith, NonAtomicRefCount);
+BENCHMARK_TEMPLATE(MakeSharedWith, LocalRefCount);
+BENCHMARK_TEMPLATE(MakeSharedWith, AtomicRefCount);
+BENCHMARK_TEMPLATE(MakeSharedWith, BiasedRefCount);
+BENCHMARK_TEMPLATE(MakeSharedWith, DeferredRefCount);
+
+template <typename Policy>
+static void CopyWith(benchmark::State& state) {
+    auto shared = MakeShared<Payload, Policy>(1);
+    AllocationReport report(state);
+    for (auto _ : state) {
+        auto copy = shared;
+        benchmark::DoNotOptimize(copy);
+    }
+}
+BENCHMARK_TEMPLATE(CopyWith, NonAtomicRefCount);
+BENCHMARK_TEMPLATE(CopyWith, LocalRefCount);
+BENCHMARK_TEMPLATE(CopyWith, AtomicRefCount);
+BENCHMARK_TEMPLATE(CopyWith, BiasedRefCount);
+BENCHMARK_TEMPLATE(CopyWith, DeferredRefCount);
+
+template <typename Policy>
+static void LockWith(benchmark::State& state) {
+    auto shared = MakeShared<Payload, Policy>(1);
+    WeakPtr<Payload, Policy> weak(shared);
+    AllocationReport report(state);
+    for (auto _ : state) {
+        auto locked = weak.Lock();
+        benchmark::DoNotOptimize(locked);
+    }
+}
+BENCHMARK_TEMPLATE(LockWith, NonAtomicRefCount);
+BENCHMARK_TEMPLATE(LockWith, LocalRefCount);
+BENCHMARK_TEMPLATE(LockWith, AtomicRefCount);
+BENCHMARK_TEMPLATE(LockWith, BiasedRefCount);
+BENCHMARK_TEMPLATE(LockWith, DeferredRefCount);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// One count shared by all threads. Thread 0 makes the object, so with BiasedRefCount it is the
+// owner on the fast path and every other thread takes the atomic one.
+
+template <typename Policy>
+static void SharedCopyWith(benchmark::State& state) {
+    static SharedPtr<Payload, Policy> shared;
+    if (state.thread_index() == 0) {
+        shared = MakeShared<Payload, Policy>(1);
+    }
+    AllocationReport report(state);
+    for (auto _ : state) {
+        auto copy = shared;
+        benchmark::DoNotOptimize(copy);
+    }
+    if (state.thread_index() == 0) {
+        shared = nullptr;
+        FinishDeferred<Policy>();
+    }
+}
+BENCHMARK_TEMPLATE(SharedCopyWith, AtomicRefCount)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(SharedCopyWith, BiasedRefCount)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(SharedCopyWith, DeferredRefCount)->ThreadRange(1, MaxBenchmarkThreads());
+
+template <typename Policy>
+static void SharedLockWith(benchmark::State& state) {
+    static SharedPtr<Payload, Policy> shared;
+    static WeakPtr<Payload, Policy> weak;
+    if (state.thread_index() == 0) {
+        shared = MakeShared<Payload, Policy>(1);
+        weak = shared;
+    }
+    AllocationReport report(state);
+    for (auto _ : state) {
+        auto locked = weak.Lock();
+        benchmark::DoNotOptimize(locked);
+    }
+    if (state.thread_index() == 0) {
+        weak = WeakPtr<Payload, Policy>();
+        shared = nullptr;
+        FinishDeferred<Policy>();
+    }
+}
+BENCHMARK_TEMPLATE(SharedLockWith, AtomicRefCount)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(SharedLockWith, BiasedRefCount)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(SharedLockWith, DeferredRefCount)->ThreadRange(1, MaxBenchmarkThreads());
+
+BENCHMARK_MAIN();
@@ -0,0 +1,120 @@
+// Macro benchmarks: whole data structures built on the pointers, ours against std
+
+#include "allocations.h"
+#include "families.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// A binary tree with owning children and weak parent links, built, walked and destroyed
+
+template <typename F>
+struct TreeNode {
+    int64_t value = 0;
+    typename F::template Shared<TreeNode> left, right;
+    typename F::template Weak<TreeNode> parent;
+};
+
+template <typename F>
+static typename F::template Shared<TreeNode<F>> BuildTree(int depth, int64_t& next) {
+    auto node = F::template MakeShared<TreeNode<F>>();
+    node->value = next++;
+    if (depth > 0) {
+        node->left = BuildTree<F>(depth - 1, next);
+        node->left->parent = node;
+        node->right = BuildTree<F>(depth - 1, next);
+        node->right->parent = node;
+    }
+    return node;
+}
+
+// Every leaf climbs to the root through the parent links
+template <typename F>
+static int64_t SumPaths(const typename F::template Shared<TreeNode<F>>& node) {
+    if (!node->left) {
+        int64_t sum = 0;
+        for (auto up = F::Lock(node->parent); up; up = F::Lock(up->parent)) {
+            sum += up->value;
+        }
+        return sum;
+    }
+    return SumPaths<F>(node->left) + SumPaths<F>(node->right);
+}
+
+template <typename F>
+static void Tree(benchmark::State& state) {
+    int depth = static_cast<int>(state.range(0));
+    AllocationReport report(state);
+    for (auto _ : state) {
+        int64_t next = 0;
+        auto root = BuildTree<F>(depth, next);
+        benchmark::DoNotOptimize(SumPaths<F>(root));
+    }
+    state.SetItemsProcessed(state.iterations() * ((int64_t{2} << depth) - 1));
+}
+BENCHMARK_TEMPLATE(Tree, Ours)->Arg(10)->Arg(16)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(Tree, Std)->Arg(10)->Arg(16)->ThreadRange(1, MaxBenchmarkThreads());
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// A subject notifying weakly held observers, some of which go away between notifications
+
+template <typename F>
+static void Observers(benchmark::State& state) {
+    size_t count = static_cast<size_t>(state.range(0));
+    std::vector<typename F::template Shared<Payload>> alive;
+    std::vector<typename F::template Weak<Payload>> observers;
+    for (size_t i = 0; i < count; ++i) {
+        alive.push_back(F::template MakeShared<Payload>(static_cast<int64_t>(i)));
+        observers.push_back(alive.back());
+    }
+    // Every fourth observer has expired
+    for (size_t i = 0; i < count; i += 4) {
+        alive[i] = nullptr;
+    }
+    AllocationReport report(state);
+    for (auto _ : state) {
+        int64_t sum = 0;
+        for (const auto& observer : observers) {
+            if (auto locked = F::Lock(observer)) {
+                sum += locked->first;
+            }
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(count));
+}
+BENCHMARK_TEMPLATE(Observers, Ours)->Arg(1024)->ThreadRange(1, MaxBenchmarkThreads());
+BENCHMARK_TEMPLATE(Observers, Std)->Arg(1024)->ThreadRange(1, MaxBenchmarkThreads());
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sorting unique owners: moves only. The owners are made with the timer paused, allocs/op still
+// counts them.
+
+template <typename F>
+static void SortOwners(benchmark::State& state) {
+    size_t count = static_cast<size_t>(state.range(0));
+    std::mt19937_64 random(42);
+    std::vector<typename F::template Unique<Payload>> owners;
+    AllocationReport report(state);
+    for (auto _ : state) {
+        state.PauseTiming();
+        owners.clear();
+        for (size_t i = 0; i < count; ++i) {
+            owners.push_back(F::template MakeUnique<Payload>(static_cast<int64_t>(random())));
+        }
+        state.ResumeTiming();
+        std::sort(owners.begin(), owners.end(),
+                  [](const auto& left, const auto& right) { return left->first < right->first; });
+        benchmark::DoNotOptimize(owners.data());
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(count));
+}
+BENCHMARK_TEMPLATE(SortOwners, Ours)->Arg(4096);
+BENCHMARK_TEMPLATE(SortOwners, Std)->Arg(4096);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,453 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>  // std::nullptr_t
+#include <utility>
+
+// Intrusive reference counting, like boost::intrusive_ptr
+//
+// The count lives in the object itself through a CRTP base, so `IntrusivePtr<T>` is a single
+// pointer and `MakeIntrusive` / `IntrusivePtr(new T)` allocate nothing but the object.
+// The pointer mirrors the SharedPtr interface, so a type can move from one to the other by
+// changing its base class and the pointer name.
+//
+// struct Message : RefCounted<Message> { ... };
+// IntrusivePtr<Message> msg = MakeIntrusive<Message>(...);
+//
+// Types that also need weak references derive from RefCountedWithWeak and use IntrusiveWeakPtr.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Counters
+
+class SimpleCounter {
+public:
+    size_t IncRef() {
+        return ++count_;
+    }
+
+    size_t DecRef() {
+        return --count_;
+    }
+
+    size_t RefCount() const {
+        return count_;
+    }
+
+private:
+    size_t count_ = 0;
+};
+
+class AtomicCounter {
+public:
+    size_t IncRef() {
+        return count_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    size_t DecRef() {
+        return count_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+
+    size_t RefCount() const {
+        return count_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<size_t> count_{0};
+};
+
+template <typename Derived>
+struct DefaultIntrusiveDelete {
+    static void Destroy(Derived* object) {
+        delete object;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Bases
+
+template <typename Derived, typename Counter = AtomicCounter,
+          typename Deleter = DefaultIntrusiveDelete<Derived>>
+class RefCounted {
+public:
+    void IncRef() const {
+        counter_.IncRef();
+    }
+
+    void DecRef() const {
+        if (counter_.DecRef() == 0) {
+            Deleter::Destroy(static_cast<Derived*>(const_cast<RefCounted*>(this)));
+        }
+    }
+
+    size_t RefCount() const {
+        return counter_.RefCount();
+    }
+
+protected:
+    RefCounted() = default;
+    // A copy of the object is not owned by anybody yet
+    RefCounted(const RefCounted&) {
+    }
+    RefCounted& operator=(const RefCounted&) {
+        return *this;
+    }
+
+private:
+    mutable Counter counter_;
+};
+
+// Created on the first weak reference and outlives the object while any of them is left.
+// `alive` is read and cleared under `lock`, so `IntrusiveWeakPtr::Lock` may safely touch
+// the count of the object until its last owner has cleared it.
+struct IntrusiveWeakAnchor {
+    void Acquire() {
+        refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    void Lock() {
+        while (lock.test_and_set(std::memory_order_acquire)) {
+        }
+    }
+
+    void Unlock() {
+        lock.clear(std::memory_order_release);
+    }
+
+    // Weak pointers plus one for the object while it is alive
+    std::atomic<size_t> refs{1};
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    bool alive = true;
+};
+
+template <typename Derived>
+class RefCountedWithWeak {
+public:
+    void IncRef() const {
+        count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Never brings back an object whose count has already reached zero
+    bool TryIncRef() const {
+        size_t cnt = count_.load(std::memory_order_relaxed);
+        while (cnt != 0) {
+            if (count_.compare_exchange_weak(cnt, cnt + 1, std::memory_order_acq_rel,
+                                             std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void DecRef() const {
+        if (count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            if (auto anchor = anchor_.load(std::memory_order_acquire)) {
+                anchor->Lock();
+                anchor->alive = false;
+                anchor->Unlock();
+                anchor->Release();
+            }
+            delete static_cast<const Derived*>(this);
+        }
+    }
+
+    size_t RefCount() const {
+        return count_.load(std::memory_order_acquire);
+    }
+
+    // Only called by an owner, so the object cannot die meanwhile
+    IntrusiveWeakAnchor* GetAnchor() const {
+        auto anchor = anchor_.load(std::memory_order_acquire);
+        if (anchor) {
+            return anchor;
+        }
+        auto fresh = new IntrusiveWeakAnchor;
+        if (anchor_.compare_exchange_strong(anchor, fresh, std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+            return fresh;
+        }
+        delete fresh;
+        return anchor;
+    }
+
+protected:
+    RefCountedWithWeak() = default;
+    RefCountedWithWeak(const RefCountedWithWeak&) {
+    }
+    RefCountedWithWeak& operator=(const RefCountedWithWeak&) {
+        return *this;
+    }
+
+private:
+    mutable std::atomic<size_t> count_{0};
+    mutable std::atomic<IntrusiveWeakAnchor*> anchor_{nullptr};
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Pointers
+
+template <typename T>
+class IntrusivePtr {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    IntrusivePtr() {
+    }
+    IntrusivePtr(std::nullptr_t) {
+    }
+    explicit IntrusivePtr(T* ptr) : ptr_(ptr) {
+        if (ptr_) {
+            ptr_->IncRef();
+        }
+    }
+
+    template <typename Y>
+    explicit IntrusivePtr(Y* ptr) : ptr_(ptr) {
+        if (ptr_) {
+            ptr_->IncRef();
+        }
+    }
+
+    IntrusivePtr(const IntrusivePtr& other) : ptr_(other.ptr_) {
+        if (ptr_) {
+            ptr_->IncRef();
+        }
+    }
+
+    template <typename Y>
+    IntrusivePtr(const IntrusivePtr<Y>& other) : ptr_(other.Get()) {
+        if (ptr_) {
+            ptr_->IncRef();
+        }
+    }
+
+    IntrusivePtr(IntrusivePtr&& other) : ptr_(other.ptr_) {
+        other.ptr_ = nullptr;
+    }
+
+    template <typename Y>
+    IntrusivePtr(IntrusivePtr<Y>&& other) : ptr_(other.ptr_) {
+        other.ptr_ = nullptr;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    IntrusivePtr& operator=(const IntrusivePtr& other) {
+        if (this != &other) {
+            if (other.ptr_) {
+                other.ptr_->IncRef();
+            }
+            Release();
+            ptr_ = other.ptr_;
+        }
+        return *this;
+    }
+
+    IntrusivePtr& operator=(IntrusivePtr&& other) {
+        if (this != &other) {
+            Release();
+            ptr_ = other.ptr_;
+            other.ptr_ = nullptr;
+        }
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~IntrusivePtr() {
+        Release();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        Release();
+        ptr_ = nullptr;
+    }
+
+    void Reset(T* ptr) {
+        if (ptr) {
+            ptr->IncRef();
+        }
+        Release();
+        ptr_ = ptr;
+    }
+
+    void Swap(IntrusivePtr& other) {
+        std::swap(ptr_, other.ptr_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return ptr_;
+    }
+
+    T& operator*() const {
+        return *ptr_;
+    }
+
+    T* operator->() const {
+        return ptr_;
+    }
+
+    size_t UseCount() const {
+        if (ptr_) {
+            return ptr_->RefCount();
+        }
+        return 0;
+    }
+
+    explicit operator bool() const {
+        return ptr_;
+    }
+
+private:
+    void Release() {
+        if (ptr_) {
+            ptr_->DecRef();
+        }
+    }
+
+    T* ptr_ = nullptr;
+
+    template <typename Y>
+    friend class IntrusivePtr;
+    template <typename Y>
+    friend class IntrusiveWeakPtr;
+};
+
+template <typename T, typename U>
+inline bool operator==(const IntrusivePtr<T>& left, const IntrusivePtr<U>& right) {
+    return left.Get() == right.Get();
+}
+
+template <typename T, typename... Args>
+IntrusivePtr<T> MakeIntrusive(Args&&... args) {
+    return IntrusivePtr<T>(new T{std::forward<Args>(args)...});
+}
+
+// Only for types derived from RefCountedWithWeak
+template <typename T>
+class IntrusiveWeakPtr {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    IntrusiveWeakPtr() {
+    }
+
+    IntrusiveWeakPtr(const IntrusivePtr<T>& other) : ptr_(other.Get()) {
+        if (ptr_) {
+            anchor_ = ptr_->GetAnchor();
+            anchor_->Acquire();
+        }
+    }
+
+    IntrusiveWeakPtr(const IntrusiveWeakPtr& other) : anchor_(other.anchor_), ptr_(other.ptr_) {
+        if (anchor_) {
+            anchor_->Acquire();
+        }
+    }
+
+    IntrusiveWeakPtr(IntrusiveWeakPtr&& other) : anchor_(other.anchor_), ptr_(other.ptr_) {
+        other.anchor_ = nullptr;
+        other.ptr_ = nullptr;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    IntrusiveWeakPtr& operator=(const IntrusiveWeakPtr& other) {
+        if (this != &other) {
+            if (other.anchor_) {
+                other.anchor_->Acquire();
+            }
+            Release();
+            anchor_ = other.anchor_;
+            ptr_ = other.ptr_;
+        }
+        return *this;
+    }
+
+    IntrusiveWeakPtr& operator=(IntrusiveWeakPtr&& other) {
+        if (this != &other) {
+            Release();
+            anchor_ = other.anchor_;
+            ptr_ = other.ptr_;
+            other.anchor_ = nullptr;
+            other.ptr_ = nullptr;
+        }
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~IntrusiveWeakPtr() {
+        Release();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        Release();
+        anchor_ = nullptr;
+        ptr_ = nullptr;
+    }
+
+    void Swap(IntrusiveWeakPtr& other) {
+        std::swap(anchor_, other.anchor_);
+        std::swap(ptr_, other.ptr_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    size_t UseCount() const {
+        if (!anchor_) {
+            return 0;
+        }
+        anchor_->Lock();
+        size_t cnt = anchor_->alive ? ptr_->RefCount() : 0;
+        anchor_->Unlock();
+        return cnt;
+    }
+
+    bool Expired() const {
+        return UseCount() == 0;
+    }
+
+    IntrusivePtr<T> Lock() const {
+        IntrusivePtr<T> result;
+        if (anchor_) {
+            anchor_->Lock();
+            if (anchor_->alive && ptr_->TryIncRef()) {
+                result.ptr_ = ptr_;
+            }
+            anchor_->Unlock();
+        }
+        return result;
+    }
+
+private:
+    void Release() {
+        if (anchor_) {
+            anchor_->Release();
+        }
+    }
+
+    IntrusiveWeakAnchor* anchor_ = nullptr;
+    T* ptr_ = nullptr;
+};
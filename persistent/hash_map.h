@@ -0,0 +1,522 @@
+#pragma once
+
+#include "node.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Persistent hash map: a hash array mapped trie (Bagwell, "Ideal Hash Trees", EPFL 2001) in the
+// compressed layout of Steindorfer and Vinju, "Optimizing Hash-Array Mapped Tries for Fast and
+// Lean Immutable JVM Collections", OOPSLA'15
+//
+// PersistentHashMap<std::string, int> empty;
+// auto one = empty.Set("a", 1);         // `empty` is still empty
+// if (const int* value = one.Find("a")) ...
+//
+// Every level takes 5 bits of the hash and keeps two bitmaps: slots holding an entry and slots
+// holding a child node, packed one after the other into the slots of the node. Keys whose hashes
+// are equal in all bits share a collision node at the bottom. Erasing folds a child left with a
+// single entry back into its parent, so a map has one shape for a given set of keys whatever the
+// history.
+//
+// Lookups and updates cost O(log32 n) nodes, an update clones the nodes on its path (see node.h).
+// `Transient()` gives in-place edits for batches, as for PersistentVector.
+
+template <typename K, typename V, typename Hash = std::hash<K>, typename Equal = std::equal_to<K>,
+          typename Policy = AtomicRefCount>
+class PersistentHashMap;
+
+template <typename K, typename V, typename Hash = std::hash<K>, typename Equal = std::equal_to<K>,
+          typename Policy = AtomicRefCount>
+class TransientHashMap;
+
+// The trie both of them edit
+template <typename K, typename V, typename Hash, typename Equal, typename Policy>
+class HashTrie {
+public:
+    size_t Size() const {
+        return size_;
+    }
+
+    const V* Find(const K& key) const {
+        size_t hash = hash_(key);
+        const Node* node = root_.Get();
+        for (int shift = 0; node; shift += kBits) {
+            if (shift >= kHashBits) {
+                for (const auto& entry : static_cast<const CollisionNode*>(node)->entries) {
+                    if (equal_(entry.first, key)) {
+                        return &entry.second;
+                    }
+                }
+                return nullptr;
+            }
+            uint32_t bit = Bit(hash, shift);
+            if (node->datamap & bit) {
+                const auto& entry = node->EntryAt(Index(node->datamap, bit));
+                return equal_(entry.first, key) ? &entry.second : nullptr;
+            }
+            if (!(node->nodemap & bit)) {
+                return nullptr;
+            }
+            node = node->ChildAt(Index(node->nodemap, bit)).Get();
+        }
+        return nullptr;
+    }
+
+    void Set(K key, V value) {
+        size_t hash = hash_(key);
+        if (Insert(root_, hash, std::move(key), std::move(value), 0)) {
+            ++size_;
+        }
+    }
+
+    // Nothing is cloned for a missing key
+    bool Erase(const K& key) {
+        if (!Find(key)) {
+            return false;
+        }
+        Remove(root_, hash_(key), key, 0);
+        if (--size_ == 0) {
+            root_.Reset();
+        }
+        return true;
+    }
+
+    template <typename Callback>
+    void ForEach(Callback& callback) const {
+        if (root_) {
+            ForEach(*root_, 0, callback);
+        }
+    }
+
+private:
+    static constexpr int kBits = 5;
+    static constexpr int kHashBits = std::numeric_limits<size_t>::digits;
+
+    using Entry = std::pair<K, V>;
+
+    // Entries are shifted between slots in place
+    static_assert(std::is_nothrow_move_constructible_v<Entry>,
+                  "keys and values must move without throwing");
+    // Nodes are edited in place as EditableNode does it, see node.h
+    static_assert(kHasExactUseCount<Policy>, "in-place edits need a policy with an exact UseCount");
+
+    struct Node;
+    using NodePtr = SharedPtr<Node, Policy>;
+
+    // An entry or a child, the bitmaps of the node tell which
+    union Slot {
+        Slot() {
+        }
+        ~Slot() {
+        }
+
+        Entry entry;
+        NodePtr child;
+    };
+
+    // The entries in slot order, then the children in slot order, in the `capacity` slots of the
+    // SizedNode this is the header of
+    struct Node {
+        size_t EntryCount() const {
+            return __builtin_popcount(datamap);
+        }
+
+        size_t SlotCount() const {
+            return __builtin_popcount(datamap | nodemap);
+        }
+
+        Entry& EntryAt(size_t index) {
+            return slots[index].entry;
+        }
+
+        const Entry& EntryAt(size_t index) const {
+            return slots[index].entry;
+        }
+
+        NodePtr& ChildAt(size_t index) {
+            return slots[EntryCount() + index].child;
+        }
+
+        const NodePtr& ChildAt(size_t index) const {
+            return slots[EntryCount() + index].child;
+        }
+
+        uint32_t datamap = 0;
+        uint32_t nodemap = 0;
+        size_t capacity = 0;
+        Slot* slots = nullptr;
+    };
+
+    // A node and its slots in one allocation. Nodes come in a few sizes, an edit that needs more
+    // room than the node has moves it to a larger one.
+    template <size_t N>
+    struct SizedNode : Node {
+        SizedNode() {
+            this->capacity = N;
+            this->slots = storage;
+        }
+
+        SizedNode(const SizedNode&) = delete;
+        SizedNode& operator=(const SizedNode&) = delete;
+
+        ~SizedNode() {
+            size_t entries = this->EntryCount();
+            for (size_t i = 0; i < entries; ++i) {
+                std::destroy_at(&storage[i].entry);
+            }
+            for (size_t i = entries; i < this->SlotCount(); ++i) {
+                std::destroy_at(&storage[i].child);
+            }
+        }
+
+        Slot storage[N];
+    };
+
+    // At the bottom, for keys whose hashes are equal in all bits: any number of them, unordered,
+    // so they keep a vector. No bitmaps and no slots.
+    struct CollisionNode : Node {
+        std::vector<Entry> entries;
+    };
+
+    static uint32_t Bit(size_t hash, int shift) {
+        return uint32_t(1) << ((hash >> shift) & 31);
+    }
+
+    // Position of the slot `bit` in the array packed by `bitmap`
+    static size_t Index(uint32_t bitmap, uint32_t bit) {
+        return __builtin_popcount(bitmap & (bit - 1));
+    }
+
+    static NodePtr MakeNode(size_t slots) {
+        if (slots <= 2) {
+            return MakeShared<SizedNode<2>, Policy>();
+        } else if (slots <= 4) {
+            return MakeShared<SizedNode<4>, Policy>();
+        } else if (slots <= 8) {
+            return MakeShared<SizedNode<8>, Policy>();
+        } else if (slots <= 16) {
+            return MakeShared<SizedNode<16>, Policy>();
+        }
+        return MakeShared<SizedNode<32>, Policy>();
+    }
+
+    // `EditableNode` for sized nodes: the node in `slot` made editable with room for `slots`
+    // slots. A node too small for them is moved to a larger one even when nobody else sees it.
+    static Node* Editable(NodePtr& slot, size_t slots) {
+        bool unique = slot && slot.UseCount() == 1;
+        if (unique && slot->capacity >= slots) {
+            return slot.Get();
+        }
+        NodePtr node = MakeNode(slots);
+        if (slot) {
+            Node& from = *slot;
+            // The bits go in one at a time: if a copy throws, the new node destroys what was made
+            size_t index = 0;
+            for (uint32_t rest = from.datamap; rest; rest &= rest - 1, ++index) {
+                Entry* entry = &node->slots[index].entry;
+                if (unique) {
+                    ::new (entry) Entry(std::move(from.slots[index].entry));
+                } else {
+                    ::new (entry) Entry(from.slots[index].entry);
+                }
+                node->datamap |= rest & (~rest + 1);
+            }
+            for (; index < from.SlotCount(); ++index) {
+                ::new (&node->slots[index].child) NodePtr(from.slots[index].child);
+            }
+            node->nodemap = from.nodemap;
+        }
+        slot = std::move(node);
+        return slot.Get();
+    }
+
+    static CollisionNode* EditableCollision(NodePtr& slot) {
+        if (!slot) {
+            slot = MakeShared<CollisionNode, Policy>();
+        } else if (slot.UseCount() != 1) {
+            slot = MakeShared<CollisionNode, Policy>(static_cast<const CollisionNode&>(*slot));
+        }
+        return static_cast<CollisionNode*>(slot.Get());
+    }
+
+    // The edits below keep the slots packed. The node has room for one more slot when one is
+    // added.
+
+    template <typename T>
+    static void Relocate(T& from, T& to) {
+        ::new (&to) T(std::move(from));
+        std::destroy_at(&from);
+    }
+
+    static void InsertEntry(Node& node, uint32_t bit, Entry entry) {
+        size_t index = Index(node.datamap, bit);
+        size_t entries = node.EntryCount();
+        for (size_t i = node.SlotCount(); i > entries; --i) {
+            Relocate(node.slots[i - 1].child, node.slots[i].child);
+        }
+        for (size_t i = entries; i > index; --i) {
+            Relocate(node.slots[i - 1].entry, node.slots[i].entry);
+        }
+        ::new (&node.slots[index].entry) Entry(std::move(entry));
+        node.datamap |= bit;
+    }
+
+    static Entry EraseEntry(Node& node, uint32_t bit) {
+        size_t index = Index(node.datamap, bit);
+        size_t entries = node.EntryCount();
+        size_t end = node.SlotCount();
+        Entry entry = std::move(node.slots[index].entry);
+        std::destroy_at(&node.slots[index].entry);
+        for (size_t i = index + 1; i < entries; ++i) {
+            Relocate(node.slots[i].entry, node.slots[i - 1].entry);
+        }
+        for (size_t i = entries; i < end; ++i) {
+            Relocate(node.slots[i].child, node.slots[i - 1].child);
+        }
+        node.datamap ^= bit;
+        return entry;
+    }
+
+    static void InsertChild(Node& node, uint32_t bit, NodePtr child) {
+        size_t index = node.EntryCount() + Index(node.nodemap, bit);
+        for (size_t i = node.SlotCount(); i > index; --i) {
+            Relocate(node.slots[i - 1].child, node.slots[i].child);
+        }
+        ::new (&node.slots[index].child) NodePtr(std::move(child));
+        node.nodemap |= bit;
+    }
+
+    static void EraseChild(Node& node, uint32_t bit) {
+        size_t index = node.EntryCount() + Index(node.nodemap, bit);
+        size_t end = node.SlotCount();
+        std::destroy_at(&node.slots[index].child);
+        for (size_t i = index + 1; i < end; ++i) {
+            Relocate(node.slots[i].child, node.slots[i - 1].child);
+        }
+        node.nodemap ^= bit;
+    }
+
+    // Returns true for a new key
+    bool Insert(NodePtr& slot, size_t hash, K key, V value, int shift) {
+        if (shift >= kHashBits) {
+            CollisionNode* node = EditableCollision(slot);
+            for (auto& entry : node->entries) {
+                if (equal_(entry.first, key)) {
+                    entry.second = std::move(value);
+                    return false;
+                }
+            }
+            node->entries.emplace_back(std::move(key), std::move(value));
+            return true;
+        }
+        uint32_t bit = Bit(hash, shift);
+        size_t slots = slot ? slot->SlotCount() : 0;
+        bool taken = slot && ((slot->datamap | slot->nodemap) & bit);
+        Node* node = Editable(slot, taken ? slots : slots + 1);
+        if (node->nodemap & bit) {
+            return Insert(node->ChildAt(Index(node->nodemap, bit)), hash, std::move(key),
+                          std::move(value), shift + kBits);
+        }
+        if (!(node->datamap & bit)) {
+            InsertEntry(*node, bit, Entry(std::move(key), std::move(value)));
+            return true;
+        }
+        Entry& entry = node->EntryAt(Index(node->datamap, bit));
+        if (equal_(entry.first, key)) {
+            entry.second = std::move(value);
+            return false;
+        }
+        // Two keys for one slot: both move down a level. The child may need several nodes, so the
+        // old entry goes there as a copy and leaves this node only once nothing can throw.
+        NodePtr child;
+        size_t other = hash_(entry.first);
+        Insert(child, hash, std::move(key), std::move(value), shift + kBits);
+        Insert(child, other, entry.first, entry.second, shift + kBits);
+        EraseEntry(*node, bit);
+        InsertChild(*node, bit, std::move(child));
+        return true;
+    }
+
+    // The key is known to be there
+    void Remove(NodePtr& slot, size_t hash, const K& key, int shift) {
+        if (shift >= kHashBits) {
+            auto& entries = EditableCollision(slot)->entries;
+            for (auto it = entries.begin(); it != entries.end(); ++it) {
+                if (equal_(it->first, key)) {
+                    entries.erase(it);
+                    return;
+                }
+            }
+            return;
+        }
+        Node* node = Editable(slot, slot->SlotCount());
+        uint32_t bit = Bit(hash, shift);
+        if (node->datamap & bit) {
+            EraseEntry(*node, bit);
+            return;
+        }
+        NodePtr& child = node->ChildAt(Index(node->nodemap, bit));
+        Remove(child, hash, key, shift + kBits);
+        // A child with a single entry left goes back into this node. Since `Remove` made the
+        // child editable, nobody else sees its entry.
+        if (Entry* last = LoneEntry(*child, shift + kBits)) {
+            Entry entry = std::move(*last);
+            EraseChild(*node, bit);
+            InsertEntry(*node, bit, std::move(entry));
+        }
+    }
+
+    // The only entry of a node without children, or nullptr
+    static Entry* LoneEntry(Node& node, int shift) {
+        if (shift >= kHashBits) {
+            auto& entries = static_cast<CollisionNode&>(node).entries;
+            return entries.size() == 1 ? &entries[0] : nullptr;
+        }
+        return node.nodemap == 0 && node.EntryCount() == 1 ? &node.EntryAt(0) : nullptr;
+    }
+
+    template <typename Callback>
+    static void ForEach(const Node& node, int shift, Callback& callback) {
+        if (shift >= kHashBits) {
+            for (const auto& entry : static_cast<const CollisionNode&>(node).entries) {
+                callback(entry.first, entry.second);
+            }
+            return;
+        }
+        size_t entries = node.EntryCount();
+        for (size_t i = 0; i < entries; ++i) {
+            callback(node.EntryAt(i).first, node.EntryAt(i).second);
+        }
+        for (size_t i = 0; i < node.SlotCount() - entries; ++i) {
+            ForEach(*node.ChildAt(i), shift + kBits, callback);
+        }
+    }
+
+    NodePtr root_;
+    size_t size_ = 0;
+    Hash hash_;
+    Equal equal_;
+};
+
+template <typename K, typename V, typename Hash, typename Equal, typename Policy>
+class PersistentHashMap {
+public:
+    PersistentHashMap() = default;
+
+    size_t Size() const {
+        return trie_.Size();
+    }
+
+    bool Empty() const {
+        return trie_.Size() == 0;
+    }
+
+    // nullptr for a missing key
+    const V* Find(const K& key) const {
+        return trie_.Find(key);
+    }
+
+    bool Contains(const K& key) const {
+        return trie_.Find(key);
+    }
+
+    // Every update returns a new version and leaves this one as it is
+
+    PersistentHashMap Set(K key, V value) const {
+        PersistentHashMap result(*this);
+        result.trie_.Set(std::move(key), std::move(value));
+        return result;
+    }
+
+    PersistentHashMap Erase(const K& key) const {
+        PersistentHashMap result(*this);
+        result.trie_.Erase(key);
+        return result;
+    }
+
+    TransientHashMap<K, V, Hash, Equal, Policy> Transient() const {
+        return TransientHashMap<K, V, Hash, Equal, Policy>(trie_);
+    }
+
+    // Calls `callback(key, value)` for every entry, in no particular order
+    template <typename Callback>
+    void ForEach(Callback callback) const {
+        trie_.ForEach(callback);
+    }
+
+private:
+    using Trie = HashTrie<K, V, Hash, Equal, Policy>;
+
+    explicit PersistentHashMap(Trie trie) : trie_(std::move(trie)) {
+    }
+
+    Trie trie_;
+
+    friend class TransientHashMap<K, V, Hash, Equal, Policy>;
+};
+
+// A map for a batch of updates: clones a shared node once and edits it in place afterwards
+template <typename K, typename V, typename Hash, typename Equal, typename Policy>
+class TransientHashMap {
+public:
+    TransientHashMap() = default;
+
+    TransientHashMap(const TransientHashMap&) = delete;
+    TransientHashMap& operator=(const TransientHashMap&) = delete;
+
+    TransientHashMap(TransientHashMap&&) = default;
+    TransientHashMap& operator=(TransientHashMap&&) = default;
+
+    size_t Size() const {
+        return trie_.Size();
+    }
+
+    bool Empty() const {
+        return trie_.Size() == 0;
+    }
+
+    const V* Find(const K& key) const {
+        return trie_.Find(key);
+    }
+
+    bool Contains(const K& key) const {
+        return trie_.Find(key);
+    }
+
+    void Set(K key, V value) {
+        trie_.Set(std::move(key), std::move(value));
+    }
+
+    // Returns false for a missing key
+    bool Erase(const K& key) {
+        return trie_.Erase(key);
+    }
+
+    template <typename Callback>
+    void ForEach(Callback callback) const {
+        trie_.ForEach(callback);
+    }
+
+    // Leaves this transient empty
+    PersistentHashMap<K, V, Hash, Equal, Policy> Persistent() {
+        return PersistentHashMap<K, V, Hash, Equal, Policy>(std::exchange(trie_, Trie()));
+    }
+
+private:
+    using Trie = HashTrie<K, V, Hash, Equal, Policy>;
+
+    explicit TransientHashMap(Trie trie) : trie_(std::move(trie)) {
+    }
+
+    Trie trie_;
+
+    friend class PersistentHashMap<K, V, Hash, Equal, Policy>;
+};
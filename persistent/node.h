@@ -0,0 +1,110 @@
+#pragma once
+
+#include "../shared-from-this/shared.h"
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Nodes of the persistent containers are shared between versions through SharedPtr and made
+// with MakeShared. They keep their values and children in arrays inside them (`NodeArray` below,
+// sized nodes in the hash map), so a node and its control block are one allocation.
+//
+// Every edit goes through `EditableNode` (or the hash map's version of it for sized nodes), which
+// clones the node first unless the pointer being edited is its only owner. A persistent update
+// copies the root pointers of the container before editing: the root is shared then, so is every
+// node below a clone, and the whole path from the root gets cloned (path copying). A transient
+// keeps editing the nodes it has cloned already in place. With AtomicRefCount the count is loaded
+// with acquire, so this holds for versions shared between threads too.
+//
+// Only policies whose count is exact (`kHasExactUseCount`) may do this: BiasedRefCount, for one,
+// sees just the references of other threads outside the owner thread, and a node would be edited
+// under them.
+
+// Creates an empty node for an empty pointer
+template <typename Node, typename Policy>
+Node* EditableNode(SharedPtr<Node, Policy>& slot) {
+    static_assert(kHasExactUseCount<Policy>, "in-place edits need a policy with an exact UseCount");
+    if (!slot) {
+        slot = MakeShared<Node, Policy>();
+    } else if (slot.UseCount() != 1) {
+        slot = MakeShared<Node, Policy>(static_cast<const Node&>(*slot));
+    }
+    return slot.Get();
+}
+
+// Up to N values stored inside the node, constructed as they are added
+template <typename T, size_t N>
+class NodeArray {
+public:
+    NodeArray() {
+    }
+
+    NodeArray(const NodeArray& other) {
+        try {
+            for (const T& value : other) {
+                ::new (end()) T(value);
+                ++size_;
+            }
+        } catch (...) {
+            std::destroy(begin(), end());
+            throw;
+        }
+    }
+
+    NodeArray& operator=(const NodeArray&) = delete;
+
+    ~NodeArray() {
+        std::destroy(begin(), end());
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    T& operator[](size_t index) {
+        return begin()[index];
+    }
+
+    const T& operator[](size_t index) const {
+        return begin()[index];
+    }
+
+    void PushBack(T value) {
+        assert(size_ < N && "the node is full");
+        ::new (end()) T(std::move(value));
+        ++size_;
+    }
+
+    void PopBack() {
+        assert(size_ > 0 && "PopBack on an empty node");
+        std::destroy_at(&begin()[--size_]);
+    }
+
+    T* begin() {
+        return std::launder(reinterpret_cast<T*>(storage_));
+    }
+
+    const T* begin() const {
+        return std::launder(reinterpret_cast<const T*>(storage_));
+    }
+
+    T* end() {
+        return begin() + size_;
+    }
+
+    const T* end() const {
+        return begin() + size_;
+    }
+
+private:
+    alignas(T) unsigned char storage_[N * sizeof(T)];
+    size_t size_ = 0;
+};
@@ -0,0 +1,359 @@
+#pragma once
+
+#include "node.h"
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+// Persistent vector: a 32-way radix-balanced tree with a tail, as in Clojure's PersistentVector
+// (Bagwell and Rompf, "RRB-Trees: Efficient Immutable Vectors", EPFL-REPORT-169879, section 2)
+//
+// PersistentVector<int> empty;
+// auto one = empty.PushBack(1);       // `empty` is still empty
+// auto two = one.Set(0, 2);           // copies the leaf and the path to it, shares the rest
+//
+// auto batch = two.Transient();       // in-place edits for a run of updates
+// for (int i = 0; i < 1000; ++i) {
+//     batch.PushBack(i);
+// }
+// auto result = batch.Persistent();
+//
+// Indexing, `Set` and `PopBack` cost O(log32 n) nodes, `PushBack` is amortized O(1): the last
+// (up to) 32 values sit in a tail leaf outside the tree. An update clones the nodes on its path,
+// see node.h. Versions may be read and updated from any thread; a transient belongs to one.
+
+template <typename T, typename Policy = AtomicRefCount>
+class PersistentVector;
+
+template <typename T, typename Policy = AtomicRefCount>
+class TransientVector;
+
+// The tree both of them edit
+template <typename T, typename Policy>
+class VectorTrie {
+public:
+    size_t Size() const {
+        return size_;
+    }
+
+    const T& operator[](size_t index) const {
+        assert(index < size_ && "index out of range");
+        return LeafAt(index)->values[index & kMask];
+    }
+
+    void PushBack(T value) {
+        if (size_ - TailOffset() < kWidth) {
+            EditableNode(tail_)->values.PushBack(std::move(value));
+            ++size_;
+            return;
+        }
+        // The tail is full and moves into the tree. With no room left under the root the tree
+        // grows a level.
+        LeafPtr full = std::move(tail_);
+        if ((size_ >> kBits) > (size_t(1) << shift_)) {
+            BranchPtr top = MakeShared<Branch, Policy>(false);
+            top->branches.PushBack(std::move(root_));
+            top->branches.PushBack(NewPath(shift_, std::move(full)));
+            root_ = std::move(top);
+            shift_ += kBits;
+        } else {
+            PushTail(shift_, root_, std::move(full));
+        }
+        tail_ = MakeShared<Leaf, Policy>();
+        tail_->values.PushBack(std::move(value));
+        ++size_;
+    }
+
+    void Set(size_t index, T value) {
+        assert(index < size_ && "index out of range");
+        if (index >= TailOffset()) {
+            EditableNode(tail_)->values[index - TailOffset()] = std::move(value);
+            return;
+        }
+        BranchPtr* slot = &root_;
+        for (int level = shift_; level > kBits; level -= kBits) {
+            slot = &EditableNode(*slot)->branches[(index >> level) & kMask];
+        }
+        LeafPtr& leaf = EditableNode(*slot)->leaves[(index >> kBits) & kMask];
+        EditableNode(leaf)->values[index & kMask] = std::move(value);
+    }
+
+    void PopBack() {
+        assert(size_ > 0 && "PopBack on an empty vector");
+        if (size_ == 1) {
+            *this = VectorTrie();
+            return;
+        }
+        if (size_ - TailOffset() > 1) {
+            EditableNode(tail_)->values.PopBack();
+            --size_;
+            return;
+        }
+        // The tail empties: the last leaf of the tree takes its place
+        tail_ = LeafAt(size_ - 2);
+        if (PopTail(shift_, root_)) {
+            root_.Reset();
+        } else if (shift_ > kBits && root_->branches.Size() == 1) {
+            BranchPtr child = root_->branches[0];
+            root_ = std::move(child);
+            shift_ -= kBits;
+        }
+        --size_;
+    }
+
+    template <typename Callback>
+    void ForEach(Callback& callback) const {
+        if (root_) {
+            ForEach(shift_, *root_, callback);
+        }
+        if (tail_) {
+            for (const T& value : tail_->values) {
+                callback(value);
+            }
+        }
+    }
+
+private:
+    static constexpr int kBits = 5;
+    static constexpr size_t kWidth = size_t(1) << kBits;
+    static constexpr size_t kMask = kWidth - 1;
+
+    struct Leaf {
+        NodeArray<T, kWidth> values;
+    };
+
+    struct Branch;
+    using BranchPtr = SharedPtr<Branch, Policy>;
+    using LeafPtr = SharedPtr<Leaf, Policy>;
+
+    // The children of a branch at level kBits are leaves, branches above it hold branches: one
+    // array of either. An empty root, the only branch `EditableNode` makes, is at level kBits.
+    struct Branch {
+        explicit Branch(bool bottom = true) : bottom(bottom) {
+            if (bottom) {
+                ::new (&leaves) NodeArray<LeafPtr, kWidth>();
+            } else {
+                ::new (&branches) NodeArray<BranchPtr, kWidth>();
+            }
+        }
+
+        Branch(const Branch& other) : bottom(other.bottom) {
+            if (bottom) {
+                ::new (&leaves) NodeArray<LeafPtr, kWidth>(other.leaves);
+            } else {
+                ::new (&branches) NodeArray<BranchPtr, kWidth>(other.branches);
+            }
+        }
+
+        Branch& operator=(const Branch&) = delete;
+
+        ~Branch() {
+            if (bottom) {
+                std::destroy_at(&leaves);
+            } else {
+                std::destroy_at(&branches);
+            }
+        }
+
+        bool bottom;
+        union {
+            NodeArray<BranchPtr, kWidth> branches;
+            NodeArray<LeafPtr, kWidth> leaves;
+        };
+    };
+
+    // Index of the first value in the tail
+    size_t TailOffset() const {
+        return size_ < kWidth ? 0 : ((size_ - 1) >> kBits) << kBits;
+    }
+
+    const LeafPtr& LeafAt(size_t index) const {
+        if (index >= TailOffset()) {
+            return tail_;
+        }
+        const Branch* node = root_.Get();
+        for (int level = shift_; level > kBits; level -= kBits) {
+            node = node->branches[(index >> level) & kMask].Get();
+        }
+        return node->leaves[(index >> kBits) & kMask];
+    }
+
+    // Appends the leaf after the last one, `size_` is the count before the push
+    void PushTail(int level, BranchPtr& slot, LeafPtr leaf) {
+        Branch* node = EditableNode(slot);
+        if (level == kBits) {
+            node->leaves.PushBack(std::move(leaf));
+            return;
+        }
+        size_t sub = ((size_ - 1) >> level) & kMask;
+        if (sub < node->branches.Size()) {
+            PushTail(level - kBits, node->branches[sub], std::move(leaf));
+        } else {
+            node->branches.PushBack(NewPath(level - kBits, std::move(leaf)));
+        }
+    }
+
+    // A chain of single-child branches from `level` down to the leaf
+    static BranchPtr NewPath(int level, LeafPtr leaf) {
+        BranchPtr node = MakeShared<Branch, Policy>(level == kBits);
+        if (level == kBits) {
+            node->leaves.PushBack(std::move(leaf));
+        } else {
+            node->branches.PushBack(NewPath(level - kBits, std::move(leaf)));
+        }
+        return node;
+    }
+
+    // Drops the last leaf, returns true when the node is left empty
+    bool PopTail(int level, BranchPtr& slot) {
+        Branch* node = EditableNode(slot);
+        if (level == kBits) {
+            node->leaves.PopBack();
+            return node->leaves.Empty();
+        }
+        size_t sub = ((size_ - 2) >> level) & kMask;
+        if (PopTail(level - kBits, node->branches[sub])) {
+            node->branches.PopBack();
+        }
+        return node->branches.Empty();
+    }
+
+    template <typename Callback>
+    static void ForEach(int level, const Branch& node, Callback& callback) {
+        if (level == kBits) {
+            for (const auto& leaf : node.leaves) {
+                for (const T& value : leaf->values) {
+                    callback(value);
+                }
+            }
+            return;
+        }
+        for (const auto& child : node.branches) {
+            ForEach(level - kBits, *child, callback);
+        }
+    }
+
+    size_t size_ = 0;
+    int shift_ = kBits;
+    // Empty pointers until there is something to hold
+    BranchPtr root_;
+    LeafPtr tail_;
+};
+
+template <typename T, typename Policy>
+class PersistentVector {
+public:
+    PersistentVector() = default;
+
+    size_t Size() const {
+        return trie_.Size();
+    }
+
+    bool Empty() const {
+        return trie_.Size() == 0;
+    }
+
+    const T& operator[](size_t index) const {
+        return trie_[index];
+    }
+
+    const T& Back() const {
+        return trie_[trie_.Size() - 1];
+    }
+
+    // Every update returns a new version and leaves this one as it is
+
+    PersistentVector PushBack(T value) const {
+        PersistentVector result(*this);
+        result.trie_.PushBack(std::move(value));
+        return result;
+    }
+
+    PersistentVector Set(size_t index, T value) const {
+        PersistentVector result(*this);
+        result.trie_.Set(index, std::move(value));
+        return result;
+    }
+
+    PersistentVector PopBack() const {
+        PersistentVector result(*this);
+        result.trie_.PopBack();
+        return result;
+    }
+
+    TransientVector<T, Policy> Transient() const {
+        return TransientVector<T, Policy>(trie_);
+    }
+
+    // Calls `callback(value)` in index order
+    template <typename Callback>
+    void ForEach(Callback callback) const {
+        trie_.ForEach(callback);
+    }
+
+private:
+    explicit PersistentVector(VectorTrie<T, Policy> trie) : trie_(std::move(trie)) {
+    }
+
+    VectorTrie<T, Policy> trie_;
+
+    friend class TransientVector<T, Policy>;
+};
+
+// A vector for a batch of updates: clones a shared node once and edits it in place afterwards
+template <typename T, typename Policy>
+class TransientVector {
+public:
+    TransientVector() = default;
+
+    TransientVector(const TransientVector&) = delete;
+    TransientVector& operator=(const TransientVector&) = delete;
+
+    TransientVector(TransientVector&&) = default;
+    TransientVector& operator=(TransientVector&&) = default;
+
+    size_t Size() const {
+        return trie_.Size();
+    }
+
+    bool Empty() const {
+        return trie_.Size() == 0;
+    }
+
+    const T& operator[](size_t index) const {
+        return trie_[index];
+    }
+
+    void PushBack(T value) {
+        trie_.PushBack(std::move(value));
+    }
+
+    void Set(size_t index, T value) {
+        trie_.Set(index, std::move(value));
+    }
+
+    void PopBack() {
+        trie_.PopBack();
+    }
+
+    template <typename Callback>
+    void ForEach(Callback callback) const {
+        trie_.ForEach(callback);
+    }
+
+    // Leaves this transient empty
+    PersistentVector<T, Policy> Persistent() {
+        return PersistentVector<T, Policy>(std::exchange(trie_, VectorTrie<T, Policy>()));
+    }
+
+private:
+    explicit TransientVector(VectorTrie<T, Policy> trie) : trie_(std::move(trie)) {
+    }
+
+    VectorTrie<T, Policy> trie_;
+
+    friend class PersistentVector<T, Policy>;
+};
@@ -0,0 +1,302 @@
+#pragma once
+
+#include "weak.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+
+// Lock-free cells holding a SharedPtr/WeakPtr, like std::atomic<std::shared_ptr>
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/atomic2
+//
+// A stored value lives in an immutable record {block, ptr}, and the cell is a single 64-bit word:
+// the record address in the low 48 bits and a local count in the high 16. The cell owns a batch
+// of kBatch references to the block. A reader pins the record with a `fetch_add` on the word,
+// which lends it one reference of the batch, adds a reference of its own to the block and gives
+// the loan back by decrementing the local count with a CAS. So the local count is the number of
+// readers in between, never more than the threads inside a `Load()` at once. The writer that
+// swaps the record out keeps the references lent to those readers and returns the rest of the
+// batch; such a reader finds its record gone, keeps the loan and drops its own reference.
+//
+// The record itself is freed by whoever finishes with it last: it starts with kBias readers, every
+// reader the writer has seen subtracts one when done, and the writer adds back kBias minus the
+// readers it has seen.
+//
+// While a value sits in a cell, its `UseCount()` includes the batch.
+//
+// Assumes user-space addresses fit in 48 bits (x86-64, AArch64) and fewer than 2^16 threads
+// inside `Load()` or `CompareExchange()` of one cell at the same time.
+
+template <typename T>
+struct AtomicCellRecord {
+    ControlBlockBase* block;
+    T* ptr;
+    std::atomic<int64_t> readers;
+};
+
+// How a cell touches the counts of the pointer it holds
+template <typename Pointer>
+struct AtomicCellRefs;
+
+template <typename T>
+struct AtomicCellRefs<SharedPtr<T>> {
+    static void Add(ControlBlockBase* block, size_t cnt) {
+        block->strong_cnt.fetch_add(cnt, std::memory_order_relaxed);
+    }
+
+    static void Sub(ControlBlockBase* block, size_t cnt) {
+        if (block->strong_cnt.fetch_sub(cnt, std::memory_order_acq_rel) == cnt) {
+            ReleaseObject<AtomicRefCount>(block);
+        }
+    }
+
+    static SharedPtr<T> Adopt(ControlBlockBase* block, T* ptr) {
+        SharedPtr<T> result;
+        result.block_ = block;
+        result.ptr_ = ptr;
+        return result;
+    }
+
+    static ControlBlockBase* Block(const SharedPtr<T>& from) {
+        return from.block_;
+    }
+
+    static T* Ptr(const SharedPtr<T>& from) {
+        return from.ptr_;
+    }
+
+    static void Steal(SharedPtr<T>& from, ControlBlockBase*& block, T*& ptr) {
+        block = from.block_;
+        ptr = from.ptr_;
+        from.block_ = nullptr;
+        from.ptr_ = nullptr;
+    }
+};
+
+template <typename T>
+struct AtomicCellRefs<WeakPtr<T>> {
+    static void Add(ControlBlockBase* block, size_t cnt) {
+        block->weak_cnt.fetch_add(cnt, std::memory_order_relaxed);
+    }
+
+    static void Sub(ControlBlockBase* block, size_t cnt) {
+        if (block->weak_cnt.fetch_sub(cnt, std::memory_order_acq_rel) == cnt) {
+            block->Destroy();
+        }
+    }
+
+    static WeakPtr<T> Adopt(ControlBlockBase* block, T* ptr) {
+        WeakPtr<T> result;
+        result.block_ = block;
+        result.ptr_ = ptr;
+        return result;
+    }
+
+    static ControlBlockBase* Block(const WeakPtr<T>& from) {
+        return from.block_;
+    }
+
+    static T* Ptr(const WeakPtr<T>& from) {
+        return from.ptr_;
+    }
+
+    static void Steal(WeakPtr<T>& from, ControlBlockBase*& block, T*& ptr) {
+        block = from.block_;
+        ptr = from.ptr_;
+        from.block_ = nullptr;
+        from.ptr_ = nullptr;
+    }
+};
+
+template <typename T, typename Pointer>
+class AtomicCell {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    AtomicCell() = default;
+
+    AtomicCell(Pointer value) : word_(Pack(MakeRecord(std::move(value)), 0)) {
+    }
+
+    AtomicCell(const AtomicCell&) = delete;
+    AtomicCell& operator=(const AtomicCell&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~AtomicCell() {
+        Retire(word_.load(std::memory_order_acquire));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Atomic operations
+
+    Pointer Load() const {
+        auto record = Unpack(Pin());
+        if (!record) {
+            return Pointer();
+        }
+        return Unpin(record);
+    }
+
+    void Store(Pointer value) {
+        Exchange(std::move(value));
+    }
+
+    Pointer Exchange(Pointer value) {
+        uint64_t word = word_.exchange(Pack(MakeRecord(std::move(value)), 0),
+                                       std::memory_order_acq_rel);
+        return Retire(word);
+    }
+
+    // Compares by (block, pointer) pair, as `owner_before` equivalence plus `get()` would.
+    // On failure `expected` receives the current value.
+    bool CompareExchange(Pointer& expected, Pointer desired) {
+        auto fresh = MakeRecord(std::move(desired));
+        while (true) {
+            uint64_t word = Pin();
+            auto record = Unpack(word);
+            ControlBlockBase* block = record ? record->block : nullptr;
+            T* ptr = record ? record->ptr : nullptr;
+
+            if (block != Refs::Block(expected) || ptr != Refs::Ptr(expected)) {
+                expected = record ? Unpin(record) : Pointer();
+                Retire(Pack(fresh, 0));
+                return false;
+            }
+
+            // Still pinned, so `record` cannot be freed and come back at the same address
+            word += kLocalOne;
+            while (Unpack(word) == record) {
+                if (word_.compare_exchange_weak(word, Pack(fresh, 0), std::memory_order_acq_rel,
+                                                std::memory_order_acquire)) {
+                    break;
+                }
+            }
+            // Either way the record is out of the cell with us counted as its reader: the loan
+            // is ours to drop
+            if (record) {
+                Refs::Adopt(block, ptr);
+                Finish(record);
+            }
+            if (Unpack(word) == record) {
+                Retire(word);
+                return true;
+            }
+            // Replaced by someone else in between, compare again
+        }
+    }
+
+    bool IsLockFree() const {
+        return true;
+    }
+
+private:
+    using Refs = AtomicCellRefs<Pointer>;
+    using Record = AtomicCellRecord<T>;
+
+    static constexpr int kLocalShift = 48;
+    static constexpr uint64_t kLocalOne = uint64_t{1} << kLocalShift;
+    static constexpr uint64_t kRecordMask = kLocalOne - 1;
+    // More than the local count can hold, so the batch is never lent out completely
+    static constexpr size_t kBatch = size_t{1} << 16;
+    static constexpr int64_t kBias = int64_t{1} << 40;
+
+    static_assert(sizeof(void*) == sizeof(uint64_t), "AtomicCell needs 64-bit pointers");
+
+    static uint64_t Pack(Record* record, size_t local) {
+        auto address = reinterpret_cast<uintptr_t>(record);
+        assert((address & ~kRecordMask) == 0);
+        return address | (uint64_t{local} << kLocalShift);
+    }
+
+    static Record* Unpack(uint64_t word) {
+        return reinterpret_cast<Record*>(word & kRecordMask);
+    }
+
+    static size_t Local(uint64_t word) {
+        return word >> kLocalShift;
+    }
+
+    // Takes over the reference of `value` and adds the rest of the batch to it
+    static Record* MakeRecord(Pointer value) {
+        ControlBlockBase* block;
+        T* ptr;
+        Refs::Steal(value, block, ptr);
+        if (!block && !ptr) {
+            return nullptr;
+        }
+        if (block) {
+            Refs::Add(block, kBatch - 1);
+        }
+        return new Record{block, ptr, kBias};
+    }
+
+    // Borrows a reference from the batch of the current record and keeps it from being freed
+    uint64_t Pin() const {
+        return word_.fetch_add(kLocalOne, std::memory_order_acquire);
+    }
+
+    // Replaces the loan with a reference of our own and gives it back
+    Pointer Unpin(Record* record) const {
+        auto result = Refs::Adopt(record->block, record->ptr);
+        if (record->block) {
+            Refs::Add(record->block, 1);
+        }
+        uint64_t word = word_.load(std::memory_order_relaxed);
+        while (Unpack(word) == record) {
+            // Release: the writer that sees the smaller count must also see our reference
+            if (word_.compare_exchange_weak(word, word - kLocalOne, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+                return result;
+            }
+        }
+        // Swapped out meanwhile: the writer has counted us and left the loan to us. We hold
+        // two references now, so dropping one cannot destroy the object.
+        if (record->block) {
+            Refs::Sub(record->block, 1);
+        }
+        Finish(record);
+        return result;
+    }
+
+    static void Finish(Record* record) {
+        if (record && record->readers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete record;
+        }
+    }
+
+    // Called on a word that is no longer in the cell: keeps one reference for the returned
+    // pointer and gives back the ones no reader has taken
+    static Pointer Retire(uint64_t word) {
+        auto record = Unpack(word);
+        if (!record) {
+            return Pointer();
+        }
+        size_t taken = Local(word);
+        auto result = Refs::Adopt(record->block, record->ptr);
+        if (record->block && kBatch - taken > 1) {
+            Refs::Sub(record->block, kBatch - taken - 1);
+        }
+        int64_t seen = static_cast<int64_t>(taken);
+        if (record->readers.fetch_add(seen - kBias, std::memory_order_acq_rel) == kBias - seen) {
+            delete record;
+        }
+        return result;
+    }
+
+    mutable std::atomic<uint64_t> word_{0};
+};
+
+template <typename T>
+class AtomicSharedPtr : public AtomicCell<T, SharedPtr<T>> {
+public:
+    using AtomicCell<T, SharedPtr<T>>::AtomicCell;
+};
+
+template <typename T>
+class AtomicWeakPtr : public AtomicCell<T, WeakPtr<T>> {
+public:
+    using AtomicCell<T, WeakPtr<T>>::AtomicCell;
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Biased reference counting, Choi, Shull and Torrellas, PACT'18
+//
+// The thread that creates an object owns its control block and counts its own references in the
+// plain `biased_cnt`. Every other thread works with `strong_cnt` atomically: there it holds their
+// (possibly negative) count shifted left by two, with the kMerged and kQueued flags in the low
+// bits. When the owner's count reaches zero both counters are merged and the block behaves as an
+// ordinary atomic one.
+//
+// A reference the owner handed off to another thread is counted in `biased_cnt` but dropped
+// through `strong_cnt`. Once that makes the shared count negative the block is queued to its
+// owner, who merges it on `BiasedRefCount::Drain()`, when it creates its next biased block, or
+// at thread exit. Until then the object stays alive, and `Lock()` from a thread other than the
+// owner may still succeed on it.
+//
+// Usage: SharedPtr<T, BiasedRefCount> and MakeShared<T, BiasedRefCount>(...)
+
+struct BiasedControlBlock;
+
+class BiasedOwner {
+public:
+    // Owner record of the calling thread, nullptr once its thread-local storage is gone
+    static BiasedOwner* Current();
+
+    // Returns false if the owner has already exited, the caller then merges the block itself
+    bool Push(BiasedControlBlock* block) {
+        std::lock_guard guard(mutex_);
+        if (!alive_) {
+            return false;
+        }
+        queue_.push_back(block);
+        pending_.store(true, std::memory_order_release);
+        return true;
+    }
+
+    // Only called by the owner thread
+    void Drain() {
+        if (pending_.load(std::memory_order_acquire)) {
+            DrainQueue();
+        }
+    }
+
+    void Acquire() {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+private:
+    struct Holder {
+        Holder();
+
+        ~Holder() {
+            auto exiting = owner;
+            owner = nullptr;
+            exiting->Exit();
+        }
+
+        BiasedOwner* owner;
+    };
+
+    void DrainQueue();
+
+    void Exit() {
+        {
+            std::lock_guard guard(mutex_);
+            alive_ = false;
+        }
+        DrainQueue();
+        Release();
+    }
+
+    std::mutex mutex_;
+    std::vector<BiasedControlBlock*> queue_;
+    bool alive_ = true;
+    std::atomic<bool> pending_{false};
+    // One for the thread itself and one for each block not merged yet
+    std::atomic<size_t> refs_{1};
+};
+
+struct BiasedControlBlock : public ControlBlockBase {
+    BiasedControlBlock() : owner(BiasedOwner::Current()) {
+        if (owner) {
+            owner->Drain();
+            owner->Acquire();
+            strong_cnt.store(0, std::memory_order_relaxed);
+        } else {
+            biased_cnt = 0;
+            merged = true;
+            strong_cnt.store(kOne | kMerged, std::memory_order_relaxed);
+        }
+    }
+
+    static constexpr size_t kMerged = 1;
+    static constexpr size_t kQueued = 2;
+    static constexpr size_t kOne = 4;
+
+    BiasedOwner* const owner;
+    // Both are touched by the owner thread only (or by whoever merges the block after it exits)
+    size_t biased_cnt = 1;
+    bool merged = false;
+};
+
+struct BiasedRefCount {
+    using Block = BiasedControlBlock;
+
+    static void IncStrong(ControlBlockBase* base) {
+        auto block = static_cast<BiasedControlBlock*>(base);
+        if (IsOwner(block)) {
+            ++block->biased_cnt;
+        } else {
+            block->strong_cnt.fetch_add(BiasedControlBlock::kOne, std::memory_order_relaxed);
+        }
+    }
+
+    static bool TryIncStrong(ControlBlockBase* base) {
+        auto block = static_cast<BiasedControlBlock*>(base);
+        if (IsOwner(block)) {
+            // The object is destroyed only by its owner while the block is not merged
+            if (Total(block) == 0) {
+                return false;
+            }
+            ++block->biased_cnt;
+            return true;
+        }
+        size_t cnt = block->strong_cnt.load(std::memory_order_relaxed);
+        while (!(cnt & BiasedControlBlock::kMerged) || Count(cnt) != 0) {
+            if (block->strong_cnt.compare_exchange_weak(cnt, cnt + BiasedControlBlock::kOne,
+                                                        std::memory_order_acq_rel,
+                                                        std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool DecStrong(ControlBlockBase* base) {
+        auto block = static_cast<BiasedControlBlock*>(base);
+        if (IsOwner(block)) {
+            if (--block->biased_cnt != 0) {
+                return false;
+            }
+            block->merged = true;
+            size_t cnt = block->strong_cnt.fetch_or(BiasedControlBlock::kMerged,
+                                                    std::memory_order_acq_rel);
+            block->owner->Release();
+            // A queued block is finished by the owner's `Drain()`
+            return !(cnt & BiasedControlBlock::kQueued) && Count(cnt) == 0;
+        }
+
+        size_t cnt = block->strong_cnt.load(std::memory_order_relaxed);
+        size_t next;
+        bool queue;
+        do {
+            next = cnt - BiasedControlBlock::kOne;
+            queue = !(cnt & (BiasedControlBlock::kMerged | BiasedControlBlock::kQueued)) &&
+                    Count(next) < 0;
+            if (queue) {
+                next |= BiasedControlBlock::kQueued;
+            }
+        } while (!block->strong_cnt.compare_exchange_weak(cnt, next, std::memory_order_acq_rel,
+                                                          std::memory_order_relaxed));
+        if (queue && !block->owner->Push(block)) {
+            return Merge(block);
+        }
+        return (cnt & BiasedControlBlock::kMerged) && !(cnt & BiasedControlBlock::kQueued) &&
+               Count(next) == 0;
+    }
+
+    static void IncWeak(ControlBlockBase* block) {
+        AtomicRefCount::IncWeak(block);
+    }
+
+    static bool DecWeak(ControlBlockBase* block) {
+        return AtomicRefCount::DecWeak(block);
+    }
+
+    // Exact in the owner thread, only the references of other threads elsewhere
+    static size_t UseCount(const ControlBlockBase* base) {
+        auto block = static_cast<const BiasedControlBlock*>(base);
+        if (IsOwner(block)) {
+            return Total(block);
+        }
+        auto cnt = Count(block->strong_cnt.load(std::memory_order_acquire));
+        return cnt > 0 ? cnt : 0;
+    }
+
+    // Merges the blocks other threads have queued to the calling thread
+    static void Drain() {
+        if (auto owner = BiasedOwner::Current()) {
+            owner->Drain();
+        }
+    }
+
+    // Folds `biased_cnt` into the shared counter and takes the block out of the queue.
+    // Returns true if no references are left.
+    static bool Merge(BiasedControlBlock* block) {
+        size_t biased = block->biased_cnt;
+        bool was_merged = block->merged;
+        block->biased_cnt = 0;
+        block->merged = true;
+
+        size_t cnt = block->strong_cnt.load(std::memory_order_relaxed);
+        size_t next;
+        do {
+            next = (cnt + biased * BiasedControlBlock::kOne) | BiasedControlBlock::kMerged;
+            next &= ~BiasedControlBlock::kQueued;
+        } while (!block->strong_cnt.compare_exchange_weak(cnt, next, std::memory_order_acq_rel,
+                                                          std::memory_order_relaxed));
+        if (!was_merged) {
+            block->owner->Release();
+        }
+        return Count(next) == 0;
+    }
+
+private:
+    static bool IsOwner(const BiasedControlBlock* block) {
+        return block->owner == BiasedOwner::Current() && !block->merged;
+    }
+
+    static intptr_t Count(size_t cnt) {
+        return static_cast<intptr_t>(cnt) >> 2;
+    }
+
+    static size_t Total(const BiasedControlBlock* block) {
+        return block->biased_cnt + Count(block->strong_cnt.load(std::memory_order_acquire));
+    }
+};
+
+inline BiasedOwner::Holder::Holder() : owner(new BiasedOwner) {
+}
+
+inline BiasedOwner* BiasedOwner::Current() {
+    static thread_local Holder holder;
+    return holder.owner;
+}
+
+inline void BiasedOwner::DrainQueue() {
+    std::vector<BiasedControlBlock*> queue;
+    {
+        std::lock_guard guard(mutex_);
+        queue.swap(queue_);
+        pending_.store(false, std::memory_order_relaxed);
+    }
+    for (auto block : queue) {
+        if (BiasedRefCount::Merge(block)) {
+            ReleaseObject<BiasedRefCount>(block);
+        }
+    }
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+// Thread-caching slab allocator for control blocks
+//
+// Requests up to kMaxSize bytes are rounded up to a multiple of kGranule and served from 64 KiB
+// slabs, each owned by one thread heap. The owner allocates and frees through a plain free list
+// per size class. Any other thread pushes a freed block onto the slab's lock-free `remote` stack,
+// which the owner takes over in one exchange once its local list runs dry.
+//
+// A heap outlives its thread: on exit it is parked and handed to the next new thread, so its
+// slabs (and the blocks freed into them from elsewhere) are reused rather than leaked.
+//
+// Larger requests go straight to ::operator new.
+
+class BlockPool {
+public:
+    static constexpr size_t kGranule = 16;
+    static constexpr size_t kMaxSize = 256;
+    static constexpr size_t kSlabSize = size_t{1} << 16;
+
+    static void* Allocate(size_t size) {
+        if (size > kMaxSize) {
+            return ::operator new(size);
+        }
+        Heap* heap = CurrentHeap();
+        if (!heap) {
+            std::lock_guard guard(OrphanMutex());
+            return OrphanHeap().Allocate(ClassOf(size));
+        }
+        return heap->Allocate(ClassOf(size));
+    }
+
+    static void Deallocate(void* ptr, size_t size) {
+        if (size > kMaxSize) {
+            ::operator delete(ptr);
+            return;
+        }
+        auto node = static_cast<FreeNode*>(ptr);
+        Slab* slab = SlabOf(ptr);
+        if (slab->heap == CurrentHeap()) {
+            slab->heap->Push(slab->size_class, node);
+        } else if (slab->heap == &OrphanHeap()) {
+            std::lock_guard guard(OrphanMutex());
+            slab->heap->Push(slab->size_class, node);
+        } else {
+            slab->PushRemote(node);
+        }
+    }
+
+private:
+    static constexpr size_t kClasses = kMaxSize / kGranule;
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    struct Heap;
+
+    struct Slab {
+        void PushRemote(FreeNode* node) {
+            FreeNode* head = remote.load(std::memory_order_relaxed);
+            do {
+                node->next = head;
+            } while (!remote.compare_exchange_weak(head, node, std::memory_order_release,
+                                                   std::memory_order_relaxed));
+            heap->has_remote.store(true, std::memory_order_release);
+        }
+
+        Heap* heap;
+        size_t size_class;
+        Slab* next;
+        // The part never handed out yet, touched by the owner only
+        char* bump;
+        char* end;
+        std::atomic<FreeNode*> remote{nullptr};
+    };
+
+    struct Heap {
+        void* Allocate(size_t size_class) {
+            FreeNode*& head = free[size_class];
+            if (!head) {
+                Refill(size_class);
+            }
+            FreeNode* node = head;
+            head = node->next;
+            return node;
+        }
+
+        void Push(size_t size_class, FreeNode* node) {
+            node->next = free[size_class];
+            free[size_class] = node;
+        }
+
+        void Refill(size_t size_class) {
+            if (has_remote.exchange(false, std::memory_order_acquire)) {
+                CollectRemote();
+                if (free[size_class]) {
+                    return;
+                }
+            }
+            Slab* slab = slabs[size_class];
+            size_t block_size = (size_class + 1) * kGranule;
+            if (!slab || slab->bump + block_size > slab->end) {
+                slab = NewSlab(size_class);
+            }
+            Push(size_class, reinterpret_cast<FreeNode*>(slab->bump));
+            slab->bump += block_size;
+        }
+
+        void CollectRemote() {
+            for (size_t size_class = 0; size_class < kClasses; ++size_class) {
+                for (Slab* slab = slabs[size_class]; slab; slab = slab->next) {
+                    FreeNode* node = slab->remote.exchange(nullptr, std::memory_order_acquire);
+                    while (node) {
+                        FreeNode* next = node->next;
+                        Push(size_class, node);
+                        node = next;
+                    }
+                }
+            }
+        }
+
+        Slab* NewSlab(size_t size_class) {
+            void* memory = ::operator new(kSlabSize, std::align_val_t{kSlabSize});
+            auto slab = new (memory) Slab{this, size_class, slabs[size_class], nullptr, nullptr};
+            constexpr size_t header = (sizeof(Slab) + kGranule - 1) / kGranule * kGranule;
+            slab->bump = static_cast<char*>(memory) + header;
+            slab->end = static_cast<char*>(memory) + kSlabSize;
+            slabs[size_class] = slab;
+            return slab;
+        }
+
+        FreeNode* free[kClasses] = {};
+        Slab* slabs[kClasses] = {};
+        std::atomic<bool> has_remote{false};
+        Heap* next_parked = nullptr;
+    };
+
+    struct HeapHolder {
+        HeapHolder() {
+            std::lock_guard guard(ParkMutex());
+            heap = ParkedHeaps();
+            if (heap) {
+                ParkedHeaps() = heap->next_parked;
+            } else {
+                heap = new Heap;
+            }
+        }
+
+        ~HeapHolder() {
+            std::lock_guard guard(ParkMutex());
+            heap->next_parked = ParkedHeaps();
+            ParkedHeaps() = heap;
+            heap = nullptr;
+        }
+
+        Heap* heap;
+    };
+
+    static size_t ClassOf(size_t size) {
+        return size == 0 ? 0 : (size - 1) / kGranule;
+    }
+
+    static Slab* SlabOf(void* ptr) {
+        return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(ptr) & ~(kSlabSize - 1));
+    }
+
+    // nullptr while the thread-local heap is being torn down
+    static Heap* CurrentHeap() {
+        static thread_local HeapHolder holder;
+        return holder.heap;
+    }
+
+    // Heaps are never freed, statics below are intentionally leaked to outlive every thread
+    static std::mutex& ParkMutex() {
+        static auto mutex = new std::mutex;
+        return *mutex;
+    }
+
+    static Heap*& ParkedHeaps() {
+        static Heap* parked = nullptr;
+        return parked;
+    }
+
+    // Serves threads whose heap is already gone
+    static std::mutex& OrphanMutex() {
+        static auto mutex = new std::mutex;
+        return *mutex;
+    }
+
+    static Heap& OrphanHeap() {
+        static auto heap = new Heap;
+        return *heap;
+    }
+};
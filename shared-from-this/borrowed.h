@@ -0,0 +1,150 @@
+#pragma once
+
+#include "shared.h"
+
+#include <cassert>
+#include <cstddef>  // std::nullptr_t
+#include <cstdio>
+#include <cstdlib>
+
+// A non-owning view of an object some SharedPtr owns, passed down a call chain instead of
+// `const SharedPtr<T>&` or a copy. Borrowing touches no counter. Since the view keeps the control
+// block, `Retain()` turns it into an owning SharedPtr where the callee really has to keep the
+// object.
+//
+// void Render(BorrowedPtr<Scene> scene);
+// Render(scene_owner);
+//
+// The caller guarantees some owner outlives the borrow. With SMART_POINTERS_DEBUG_CHECKS defined
+// (see local.h; the same in every translation unit, NDEBUG does not matter) this is checked: a
+// borrow holds a weak reference, so the block cannot go away under it, and every access aborts
+// if the object is gone. Without it a borrow is just the two pointers.
+
+template <typename T, typename Policy = AtomicRefCount>
+class BorrowedPtr {
+public:
+    using ElementType = std::remove_extent_t<T>;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    BorrowedPtr() {
+    }
+    BorrowedPtr(std::nullptr_t) {
+    }
+
+    template <typename Y>
+    BorrowedPtr(const SharedPtr<Y, Policy>& owner) : block_(owner.GetBlock()), ptr_(owner.Get()) {
+        Track();
+    }
+
+    // The temporary would be gone before the borrow is used
+    template <typename Y>
+    BorrowedPtr(SharedPtr<Y, Policy>&& owner) = delete;
+
+    BorrowedPtr(const BorrowedPtr& other) : block_(other.block_), ptr_(other.ptr_) {
+        Track();
+    }
+
+    template <typename Y>
+    BorrowedPtr(const BorrowedPtr<Y, Policy>& other) : block_(other.block_), ptr_(other.ptr_) {
+        Track();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    BorrowedPtr& operator=(const BorrowedPtr& other) {
+        if (this != &other) {
+            Untrack();
+            block_ = other.block_;
+            ptr_ = other.ptr_;
+            Track();
+        }
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~BorrowedPtr() {
+        Untrack();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    ElementType* Get() const {
+        Check();
+        return ptr_;
+    }
+
+    T& operator*() const {
+        Check();
+        return *ptr_;
+    }
+
+    ElementType* operator->() const {
+        Check();
+        return ptr_;
+    }
+
+    explicit operator bool() const {
+        return block_;
+    }
+
+    // One more owner, the only place a borrow touches the counts
+    SharedPtr<T, Policy> Retain() const {
+        Check();
+        return SharedPtr<T, Policy>(block_, ptr_);
+    }
+
+private:
+    void Track() {
+#ifdef SMART_POINTERS_DEBUG_CHECKS
+        if (block_) {
+            Policy::IncWeak(block_);
+        }
+#endif
+    }
+
+    void Untrack() {
+#ifdef SMART_POINTERS_DEBUG_CHECKS
+        if (block_ && Policy::DecWeak(block_)) {
+            block_->Destroy();
+        }
+#endif
+    }
+
+    void Check() const {
+#ifdef SMART_POINTERS_DEBUG_CHECKS
+        if (block_ && Policy::UseCount(block_) == 0) {
+            std::fputs("BorrowedPtr outlived its owners\n", stderr);
+            std::abort();
+        }
+#endif
+    }
+
+    ControlBlockBase* block_ = nullptr;
+    ElementType* ptr_ = nullptr;
+
+    template <typename Y, typename P>
+    friend class BorrowedPtr;
+};
+
+// A borrow that is never empty: made from an owner only, and dereferenced like a reference
+template <typename T, typename Policy = AtomicRefCount>
+class SharedRef : public BorrowedPtr<T, Policy> {
+public:
+    template <typename Y>
+    SharedRef(const SharedPtr<Y, Policy>& owner) : BorrowedPtr<T, Policy>(owner) {
+        assert(owner && "SharedRef to an empty SharedPtr");
+    }
+
+    template <typename Y>
+    SharedRef(SharedPtr<Y, Policy>&& owner) = delete;
+
+    operator T&() const {
+        return *this->Get();
+    }
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "shared.h"
+
+#include <cassert>
+#include <cstddef>  // std::nullptr_t
+#include <utility>
+
+// Copy-on-write owner of a value
+//
+// CowPtr<Config> config = MakeCow<Config>(Load());
+// CowPtr<Config> snapshot = config;  // shares the object
+// config.Write().timeout = 5;        // copies it first, `snapshot` is left alone
+//
+// Copies of a CowPtr share one object and read it through const access. `Write()` hands out a
+// mutable reference, cloning the object (with the copy constructor) first unless this pointer is
+// its only owner.
+//
+// The check is "no weak references" followed by `UseCount() == 1`, both loads acquire with
+// AtomicRefCount. The weak count comes first: a `WeakPtr::Lock` between the two loads would
+// otherwise go unnoticed, since its owner may be gone again by the time the weak count is read.
+// Once the weak count is at its base value, a new weak reference can only be made by an owner,
+// and with no other owner left, nobody can bring one back. Objects that derive from
+// EnableSharedFromThis always hold a weak reference, so they are cloned on every write. Owners
+// that drop their reference late (DeferredRefCount) only cause an extra clone.
+//
+// Owners handed out by `Share()`, and the SharedPtr a CowPtr is made from, must not be used to
+// make WeakPtrs: such a weak reference, made and locked between the two loads, would escape the
+// check. They must not write to the object either.
+
+template <typename T, typename Policy = AtomicRefCount>
+class CowPtr {
+    // BiasedRefCount, for one, counts only the other threads' references outside the owner thread
+    static_assert(kHasExactUseCount<Policy>, "CowPtr needs a policy with an exact UseCount");
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    CowPtr() {
+    }
+    CowPtr(std::nullptr_t) {
+    }
+
+    explicit CowPtr(SharedPtr<T, Policy> ptr) : ptr_(std::move(ptr)) {
+    }
+
+    // Copies and moves are those of SharedPtr: copying only shares
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // Clones the object first if anyone else may see it. The reference must not be kept past the
+    // next copy of this CowPtr: it would write to the shared object. Not for an empty CowPtr.
+    T& Write() {
+        assert(ptr_ && "Write on an empty CowPtr");
+        if (!IsUnique()) {
+            ptr_ = MakeShared<T, Policy>(static_cast<const T&>(*ptr_));
+        }
+        return *ptr_;
+    }
+
+    void Reset() {
+        ptr_.Reset();
+    }
+
+    void Swap(CowPtr& other) {
+        ptr_.Swap(other.ptr_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    const T* Get() const {
+        return ptr_.Get();
+    }
+
+    const T& operator*() const {
+        return *ptr_;
+    }
+
+    const T* operator->() const {
+        return ptr_.Get();
+    }
+
+    explicit operator bool() const {
+        return static_cast<bool>(ptr_);
+    }
+
+    size_t UseCount() const {
+        return ptr_.UseCount();
+    }
+
+    // True for an empty pointer as well. The weak count is read first, see above.
+    bool IsUnique() const {
+        auto block = ptr_.GetBlock();
+        if (!block) {
+            return true;
+        }
+        if (block->weak_cnt.load(std::memory_order_acquire) != 1) {
+            return false;
+        }
+        return Policy::UseCount(block) == 1;
+    }
+
+    // A read-only owner of the current object, for code that takes SharedPtr. Do not make a
+    // WeakPtr from it, see above.
+    SharedPtr<const T, Policy> Share() const {
+        return ptr_;
+    }
+
+private:
+    SharedPtr<T, Policy> ptr_;
+};
+
+template <typename T, typename Policy = AtomicRefCount, typename... Args>
+CowPtr<T, Policy> MakeCow(Args&&... args) {
+    return CowPtr<T, Policy>(MakeShared<T, Policy>(std::forward<Args>(args)...));
+};
@@ -0,0 +1,526 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Cycle collection by trial deletion, Bacon and Rajan, ECOOP'01 (the synchronous algorithm)
+//
+// A type takes part by listing the SharedPtr members it owns:
+//
+// struct Node {
+//     SharedPtr<Node, CycleRefCount> parent, child;
+//     void TraverseRefs(CycleVisitor& visit) const {
+//         visit(parent);
+//         visit(child);
+//     }
+// };
+//
+// Whenever a count of such an object drops without reaching zero, or a reference to it is moved,
+// the block is buffered as a possible root of a garbage cycle. `Collect(budget)` of
+// `CycleCollector::Local()` then looks for subgraphs kept alive only by references from inside
+// themselves and destroys them.
+//
+// Collection runs in slices. The subtraction of internal references goes to a trial count next to
+// the real one, and every phase keeps its work on an explicit stack, so a slice can stop after any
+// node. Between slices the program may go on using the graph: a count change, move or swap of a
+// reference to a block of the batch in progress restarts the batch (the Moved hook of shared.h
+// reports the last two). A graph that changes faster than it can be scanned is not collected.
+//
+// Counts are plain, like NonAtomicRefCount: a graph and its collector belong to one thread.
+// Objects without `TraverseRefs` are leaves to the collector: never roots, and anything they
+// point to is treated as referenced from outside.
+
+class CycleVisitor;
+
+struct CycleControlBlock : public ControlBlockBase {
+    enum Color : uint8_t {
+        kBlack,  // In use or free
+        kGray,   // Possible member of a cycle
+        kWhite,  // Member of a garbage cycle
+        kPurple, // Possible root of a cycle
+        kFreeing // Garbage being destroyed, its count is no longer touched
+    };
+
+    // Set by `CycleRefCount::Adopt` for types with `TraverseRefs`
+    void* object = nullptr;
+    void (*traverse)(void* object, CycleVisitor& visitor) = nullptr;
+    // The count less the references from the subgraph being analyzed
+    size_t trial = 0;
+    Color color = kBlack;
+    bool buffered = false;
+    // Part of the batch being analyzed
+    bool visited = false;
+    // The last batch that saw a reference to the block change before visiting it
+    uint32_t touched = 0;
+};
+
+class CycleVisitor {
+public:
+    template <typename T, typename Policy>
+    void operator()(const SharedPtr<T, Policy>& ptr) {
+        if (auto block = ptr.GetBlock()) {
+            visit_(static_cast<CycleControlBlock*>(block), context_);
+        }
+    }
+
+private:
+    CycleVisitor(void (*visit)(CycleControlBlock* block, void* context), void* context)
+        : visit_(visit), context_(context) {
+    }
+
+    void (*visit_)(CycleControlBlock* block, void* context);
+    void* context_;
+
+    friend class CycleCollector;
+};
+
+class CycleCollector {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    CycleCollector() = default;
+    CycleCollector(const CycleCollector&) = delete;
+    CycleCollector& operator=(const CycleCollector&) = delete;
+
+    ~CycleCollector() {
+        Collect(Clock::duration::max());
+    }
+
+    // The collector of the calling thread. Whatever is still buffered is collected when the
+    // thread exits.
+    static CycleCollector& Local();
+
+    // Local(), or nullptr once it has been torn down: static SharedPtrs drop their references
+    // after the thread_local destructors of the main thread have run. Such roots are not
+    // buffered any more, a garbage cycle found that late is leaked.
+    static CycleCollector* LocalIfAlive() {
+        if (LocalTornDown()) {
+            return nullptr;
+        }
+        return &Local();
+    }
+
+    // Works through the buffered roots until none are left or `budget` is spent, checking the
+    // clock after every node (or every destructor), so a slice overruns by one step at most. Every
+    // call makes some progress. Returns the number of objects destroyed.
+    size_t Collect(Clock::duration budget) {
+        auto start = Clock::now();
+        size_t freed = 0;
+        while (phase_ != kIdle || !roots_.empty()) {
+            freed += Step();
+            if (Clock::now() - start >= budget) {
+                break;
+            }
+        }
+        return freed;
+    }
+
+    // Including the roots of the batch in progress
+    size_t Pending() const {
+        return roots_.size() + batch_.size();
+    }
+
+    // Called on a count that dropped but not to zero. The buffer holds a weak reference.
+    void PossibleRoot(CycleControlBlock* block) {
+        block->color = CycleControlBlock::kPurple;
+        if (!block->buffered) {
+            block->buffered = true;
+            NonAtomicRefCount::IncWeak(block);
+            roots_.push_back(block);
+        }
+    }
+
+    // Called before the program changes the references to `block`. A change to a visited block
+    // invalidates the batch, so does one to a block visited later on: the new reference may come
+    // from a block whose children were listed already.
+    void Touch(CycleControlBlock* block) {
+        if (phase_ != kMarkGray && phase_ != kScan) {
+            return;
+        }
+        if (block->visited) {
+            dirty_ = true;
+        } else {
+            block->touched = batch_id_;
+        }
+    }
+
+    // Garbage found by the batch in progress, which nobody may bring back
+    bool Claimed(const CycleControlBlock* block) const {
+        return block->color == CycleControlBlock::kWhite &&
+               (phase_ == kCollectWhite || phase_ == kFree);
+    }
+
+private:
+    static constexpr size_t kBatch = 64;
+
+    enum Phase : uint8_t {
+        kIdle,
+        kMarkGray,     // Trial counts of everything reachable from the roots
+        kScan,         // Gray with a trial count left is alive, so is all it reaches
+        kCollectWhite, // Whatever is white now is garbage
+        kFree,
+        kRelease       // Drops the references to the visited blocks
+    };
+
+    struct LocalHolder;
+
+    // Trivially destructible, so it can still be read after the holder is gone
+    static bool& LocalTornDown() {
+        static thread_local bool torn_down = false;
+        return torn_down;
+    }
+
+    size_t Step() {
+        if (dirty_ && (phase_ == kMarkGray || phase_ == kScan)) {
+            Abort();
+            return 0;
+        }
+        switch (phase_) {
+            case kIdle:
+                StartBatch();
+                return 0;
+            case kMarkGray:
+                MarkGrayStep();
+                return 0;
+            case kScan:
+                ScanStep();
+                return 0;
+            case kCollectWhite:
+                CollectWhiteStep();
+                return 0;
+            case kFree:
+                return FreeStep();
+            case kRelease:
+                ReleaseStep();
+                return 0;
+        }
+        return 0;
+    }
+
+    // MarkRoots
+    void StartBatch() {
+        for (size_t i = 0; i < kBatch && !roots_.empty(); ++i) {
+            auto block = roots_.back();
+            roots_.pop_back();
+            if (block->color == CycleControlBlock::kPurple && UseCount(block) > 0) {
+                batch_.push_back(block);
+            } else {
+                Unbuffer(block);
+            }
+        }
+        dirty_ = false;
+        cursor_ = 0;
+        ++batch_id_;
+        if (!batch_.empty()) {
+            phase_ = kMarkGray;
+        }
+    }
+
+    // Subtracts the references from inside the subgraph of the roots, one node per step
+    void MarkGrayStep() {
+        if (stack_.empty()) {
+            if (cursor_ == batch_.size()) {
+                cursor_ = 0;
+                phase_ = kScan;
+                return;
+            }
+            // Roots are only visited from here on, the program may have dropped them meanwhile
+            auto root = batch_[cursor_++];
+            if (root->color == CycleControlBlock::kPurple && UseCount(root) > 0) {
+                Gray(root);
+            }
+            return;
+        }
+        ForEachChild(Pop(), [this](CycleControlBlock* child) {
+            Gray(child);
+            --child->trial;
+        });
+    }
+
+    void Gray(CycleControlBlock* block) {
+        if (block->visited) {
+            return;
+        }
+        if (block->touched == batch_id_) {
+            dirty_ = true;
+        }
+        block->visited = true;
+        block->color = CycleControlBlock::kGray;
+        block->trial = UseCount(block);
+        NonAtomicRefCount::IncWeak(block);
+        visited_.push_back(block);
+        stack_.push_back(block);
+    }
+
+    // Blackens what is pending first, then goes on with the white search
+    void ScanStep() {
+        if (!black_.empty()) {
+            auto block = black_.back();
+            black_.pop_back();
+            ForEachChild(block, [this](CycleControlBlock* child) {
+                if (child->color == CycleControlBlock::kGray ||
+                    child->color == CycleControlBlock::kWhite) {
+                    child->color = CycleControlBlock::kBlack;
+                    black_.push_back(child);
+                }
+            });
+            return;
+        }
+        if (stack_.empty()) {
+            if (cursor_ == batch_.size()) {
+                cursor_ = 0;
+                phase_ = kCollectWhite;
+            } else {
+                stack_.push_back(batch_[cursor_++]);
+            }
+            return;
+        }
+        auto block = Pop();
+        if (block->color != CycleControlBlock::kGray) {
+            return;
+        }
+        if (block->trial > 0) {
+            block->color = CycleControlBlock::kBlack;
+            black_.push_back(block);
+            return;
+        }
+        block->color = CycleControlBlock::kWhite;
+        ForEachChild(block, [this](CycleControlBlock* child) { stack_.push_back(child); });
+    }
+
+    // The count drops to zero right away, so that weak references see the object as gone
+    void CollectWhiteStep() {
+        if (cursor_ == visited_.size()) {
+            cursor_ = 0;
+            phase_ = kFree;
+            return;
+        }
+        auto block = visited_[cursor_++];
+        if (block->color == CycleControlBlock::kWhite) {
+            block->color = CycleControlBlock::kFreeing;
+            block->strong_cnt.store(0, std::memory_order_relaxed);
+            garbage_.push_back(block);
+        }
+    }
+
+    // References between garbage objects are ignored by `CycleRefCount::DecStrong`, the ones to
+    // live objects are dropped by the destructors as usual
+    size_t FreeStep() {
+        if (cursor_ == garbage_.size()) {
+            cursor_ = 0;
+            phase_ = kRelease;
+            return 0;
+        }
+        auto block = garbage_[cursor_++];
+        block->DeletePtr();
+        // The weak reference of the strong ones, as in `ReleaseObject`. The one in `visited_`
+        // keeps the block.
+        NonAtomicRefCount::DecWeak(block);
+        return 1;
+    }
+
+    void ReleaseStep() {
+        if (cursor_ == visited_.size()) {
+            // A root dropped again after the scan is a root of the next batch
+            for (auto block : batch_) {
+                if (block->color == CycleControlBlock::kPurple && UseCount(block) > 0) {
+                    roots_.push_back(block);
+                } else {
+                    Unbuffer(block);
+                }
+            }
+            batch_.clear();
+            visited_.clear();
+            garbage_.clear();
+            cursor_ = 0;
+            phase_ = kIdle;
+            aborted_ = false;
+            return;
+        }
+        auto block = visited_[cursor_++];
+        block->visited = false;
+        // Nothing an aborted batch has found holds, buffered blocks stay roots
+        if (aborted_) {
+            bool root = block->buffered && UseCount(block) > 0;
+            block->color = root ? CycleControlBlock::kPurple : CycleControlBlock::kBlack;
+        }
+        if (NonAtomicRefCount::DecWeak(block)) {
+            block->Destroy();
+        }
+    }
+
+    // The graph changed under the batch: its roots go back to the buffer and will be analyzed
+    // again, the visited blocks are released a step at a time as after a completed batch
+    void Abort() {
+        roots_.insert(roots_.end(), batch_.begin(), batch_.end());
+        batch_.clear();
+        stack_.clear();
+        black_.clear();
+        cursor_ = 0;
+        phase_ = kRelease;
+        aborted_ = true;
+    }
+
+    static void Unbuffer(CycleControlBlock* block) {
+        block->buffered = false;
+        if (block->color == CycleControlBlock::kPurple) {
+            block->color = CycleControlBlock::kBlack;
+        }
+        if (NonAtomicRefCount::DecWeak(block)) {
+            block->Destroy();
+        }
+    }
+
+    template <typename Visit>
+    static void ForEachChild(CycleControlBlock* block, Visit visit) {
+        if (!block->traverse) {
+            return;
+        }
+        CycleVisitor visitor(
+            [](CycleControlBlock* child, void* context) { (*static_cast<Visit*>(context))(child); },
+            &visit);
+        block->traverse(block->object, visitor);
+    }
+
+    CycleControlBlock* Pop() {
+        auto block = stack_.back();
+        stack_.pop_back();
+        return block;
+    }
+
+    static size_t UseCount(const CycleControlBlock* block) {
+        return NonAtomicRefCount::UseCount(block);
+    }
+
+    std::vector<CycleControlBlock*> roots_;
+    // The batch in progress. Every visited block is held by a weak reference until it is released.
+    std::vector<CycleControlBlock*> batch_;
+    std::vector<CycleControlBlock*> visited_;
+    std::vector<CycleControlBlock*> garbage_;
+    std::vector<CycleControlBlock*> stack_;
+    std::vector<CycleControlBlock*> black_;
+    size_t cursor_ = 0;
+    uint32_t batch_id_ = 0;
+    Phase phase_ = kIdle;
+    bool dirty_ = false;
+    bool aborted_ = false;
+};
+
+struct CycleCollector::LocalHolder {
+    // Collecting may buffer more roots, so the flag is only set once nothing is left
+    ~LocalHolder() {
+        collector.Collect(Clock::duration::max());
+        LocalTornDown() = true;
+    }
+
+    CycleCollector collector;
+};
+
+inline CycleCollector& CycleCollector::Local() {
+    static thread_local LocalHolder holder;
+    return holder.collector;
+}
+
+struct CycleRefCount {
+    using Block = CycleControlBlock;
+
+    // Destructors of garbage may still copy the references between garbage objects
+    static void IncStrong(ControlBlockBase* base) {
+        auto block = static_cast<CycleControlBlock*>(base);
+        if (block->color == CycleControlBlock::kFreeing) {
+            return;
+        }
+        Touch(block);
+        NonAtomicRefCount::IncStrong(block);
+        block->color = CycleControlBlock::kBlack;
+    }
+
+    // Garbage being freed has a zero count already, garbage about to be freed is claimed
+    static bool TryIncStrong(ControlBlockBase* base) {
+        auto block = static_cast<CycleControlBlock*>(base);
+        if (block->color == CycleControlBlock::kFreeing) {
+            return false;
+        }
+        if (auto collector = CycleCollector::LocalIfAlive()) {
+            if (collector->Claimed(block)) {
+                return false;
+            }
+            collector->Touch(block);
+        }
+        if (!NonAtomicRefCount::TryIncStrong(block)) {
+            return false;
+        }
+        block->color = CycleControlBlock::kBlack;
+        return true;
+    }
+
+    static bool DecStrong(ControlBlockBase* base) {
+        auto block = static_cast<CycleControlBlock*>(base);
+        if (block->color == CycleControlBlock::kFreeing) {
+            return false;
+        }
+        Touch(block);
+        if (NonAtomicRefCount::DecStrong(block)) {
+            block->color = CycleControlBlock::kBlack;
+            return true;
+        }
+        // A leaf cannot close a cycle
+        if (block->traverse) {
+            if (auto collector = CycleCollector::LocalIfAlive()) {
+                collector->PossibleRoot(block);
+            }
+        }
+        return false;
+    }
+
+    // A reference moved into an object may have been the last one from outside, so the block is
+    // a possible root as after a decrement
+    static void Moved(ControlBlockBase* base) {
+        auto block = static_cast<CycleControlBlock*>(base);
+        if (block->color == CycleControlBlock::kFreeing) {
+            return;
+        }
+        Touch(block);
+        if (block->traverse) {
+            if (auto collector = CycleCollector::LocalIfAlive()) {
+                collector->PossibleRoot(block);
+            }
+        }
+    }
+
+    static void IncWeak(ControlBlockBase* block) {
+        NonAtomicRefCount::IncWeak(block);
+    }
+
+    static bool DecWeak(ControlBlockBase* block) {
+        return NonAtomicRefCount::DecWeak(block);
+    }
+
+    static size_t UseCount(const ControlBlockBase* block) {
+        return NonAtomicRefCount::UseCount(block);
+    }
+
+    template <typename Y>
+    static auto Adopt(ControlBlockBase* base, Y* ptr)
+        -> decltype(ptr->TraverseRefs(std::declval<CycleVisitor&>())) {
+        if (!ptr) {
+            return;
+        }
+        auto block = static_cast<CycleControlBlock*>(base);
+        block->object = const_cast<std::remove_cv_t<Y>*>(ptr);
+        block->traverse = [](void* object, CycleVisitor& visitor) {
+            static_cast<Y*>(object)->TraverseRefs(visitor);
+        };
+    }
+
+private:
+    static void Touch(CycleControlBlock* block) {
+        if (auto collector = CycleCollector::LocalIfAlive()) {
+            collector->Touch(block);
+        }
+    }
+};
@@ -0,0 +1,277 @@
+#pragma once
+
+#include "shared.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <mutex>
+#include <vector>
+
+// Hazard pointers, Michael, IEEE TPDS 2004
+//
+// A `HazardCell<T>` publishes a SharedPtr<T> to readers. A reader protects the raw `T*` with a
+// `HazardPointer` and uses it for a short scope without touching any reference count:
+//
+// HazardCell<Config> config(MakeShared<Config>());
+// ...
+// HazardPointer hazard;
+// const Config* current = hazard.Protect(config);
+//
+// A pointer replaced in the cell is retired to the cell's domain, which keeps its strong
+// reference until no hazard pointer holds the object. Only then the reference is dropped, so
+// `DeletePtr` of the last owner never runs under a reader.
+//
+// Writers are serialized by a mutex, readers never block.
+
+class HazardDomain {
+public:
+    // One slot a reader publishes its pointer in. Records are reused but never freed before
+    // their domain.
+    struct Record {
+        std::atomic<const void*> ptr{nullptr};
+        std::atomic<bool> active{true};
+        Record* next = nullptr;
+    };
+
+    HazardDomain() = default;
+    HazardDomain(const HazardDomain&) = delete;
+    HazardDomain& operator=(const HazardDomain&) = delete;
+
+    // No hazard pointer of the domain may be alive at this point
+    ~HazardDomain() {
+        Reclaim();
+        assert(retired_.empty());
+        for (Record* record = records_.load(std::memory_order_acquire); record;) {
+            Record* next = record->next;
+            delete record;
+            record = next;
+        }
+    }
+
+    // Leaked on purpose, so that it outlives every thread that may still retire into it
+    static HazardDomain& Global() {
+        static auto domain = new HazardDomain;
+        return *domain;
+    }
+
+    Record* AcquireRecord() {
+        for (Record* record = records_.load(std::memory_order_acquire); record;
+             record = record->next) {
+            bool active = false;
+            if (!record->active.load(std::memory_order_relaxed) &&
+                record->active.compare_exchange_strong(active, true, std::memory_order_acquire,
+                                                       std::memory_order_relaxed)) {
+                return record;
+            }
+        }
+        auto record = new Record;
+        Record* head = records_.load(std::memory_order_relaxed);
+        do {
+            record->next = head;
+        } while (!records_.compare_exchange_weak(head, record, std::memory_order_release,
+                                                 std::memory_order_relaxed));
+        record_cnt_.fetch_add(1, std::memory_order_relaxed);
+        return record;
+    }
+
+    void ReleaseRecord(Record* record) {
+        record->ptr.store(nullptr, std::memory_order_release);
+        record->active.store(false, std::memory_order_release);
+    }
+
+    // Takes over the reference of `value`
+    template <typename T, typename Policy>
+    void Retire(SharedPtr<T, Policy> value) {
+        if (!value.block_) {
+            return;
+        }
+        Retired retired{value.ptr_, value.block_, &DropStrong<Policy>};
+        value.block_ = nullptr;
+        value.ptr_ = nullptr;
+
+        bool scan;
+        {
+            std::lock_guard guard(mutex_);
+            retired_.push_back(retired);
+            scan = retired_.size() >= ScanThreshold();
+        }
+        if (scan) {
+            Reclaim();
+        }
+    }
+
+    // Drops every retired reference no hazard pointer protects any more
+    void Reclaim() {
+        std::vector<Retired> retired;
+        {
+            std::lock_guard guard(mutex_);
+            retired.swap(retired_);
+        }
+        if (retired.empty()) {
+            return;
+        }
+
+        std::vector<const void*> hazards;
+        for (Record* record = records_.load(std::memory_order_acquire); record;
+             record = record->next) {
+            if (auto ptr = record->ptr.load(std::memory_order_seq_cst)) {
+                hazards.push_back(ptr);
+            }
+        }
+        std::sort(hazards.begin(), hazards.end());
+
+        std::vector<Retired> kept;
+        for (const Retired& item : retired) {
+            if (std::binary_search(hazards.begin(), hazards.end(), item.ptr)) {
+                kept.push_back(item);
+            } else {
+                // May run a destructor that retires again, hence outside the lock
+                item.release(item.block);
+            }
+        }
+        if (!kept.empty()) {
+            std::lock_guard guard(mutex_);
+            retired_.insert(retired_.end(), kept.begin(), kept.end());
+        }
+    }
+
+    // Retired references still waiting for readers
+    size_t Pending() const {
+        std::lock_guard guard(mutex_);
+        return retired_.size();
+    }
+
+private:
+    struct Retired {
+        const void* ptr;
+        ControlBlockBase* block;
+        void (*release)(ControlBlockBase* block);
+    };
+
+    template <typename Policy>
+    static void DropStrong(ControlBlockBase* block) {
+        if (Policy::DecStrong(block)) {
+            ReleaseObject<Policy>(block);
+        }
+    }
+
+    // Amortizes a scan over as many retirements as there are records
+    size_t ScanThreshold() const {
+        return std::max<size_t>(kMinScan, 2 * record_cnt_.load(std::memory_order_relaxed));
+    }
+
+    static constexpr size_t kMinScan = 64;
+
+    std::atomic<Record*> records_{nullptr};
+    std::atomic<size_t> record_cnt_{0};
+    mutable std::mutex mutex_;
+    std::vector<Retired> retired_;
+};
+
+template <typename T, typename Policy = AtomicRefCount>
+class HazardCell {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    explicit HazardCell(HazardDomain& domain = HazardDomain::Global()) : domain_(domain) {
+    }
+
+    explicit HazardCell(SharedPtr<T, Policy> value, HazardDomain& domain = HazardDomain::Global())
+        : domain_(domain), value_(std::move(value)), ptr_(value_.Get()) {
+    }
+
+    HazardCell(const HazardCell&) = delete;
+    HazardCell& operator=(const HazardCell&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~HazardCell() {
+        domain_.Retire(std::move(value_));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Store(SharedPtr<T, Policy> value) {
+        SharedPtr<T, Policy> old;
+        {
+            std::lock_guard guard(mutex_);
+            old = std::move(value_);
+            value_ = std::move(value);
+            ptr_.store(value_.Get(), std::memory_order_seq_cst);
+        }
+        domain_.Retire(std::move(old));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    // A counted copy, for readers that need the object beyond a hazard scope
+    SharedPtr<T, Policy> Load() const {
+        std::lock_guard guard(mutex_);
+        return value_;
+    }
+
+    HazardDomain& Domain() const {
+        return domain_;
+    }
+
+private:
+    HazardDomain& domain_;
+    mutable std::mutex mutex_;
+    SharedPtr<T, Policy> value_;
+    // Mirrors `value_.Get()` for readers
+    std::atomic<T*> ptr_{nullptr};
+
+    friend class HazardPointer;
+};
+
+class HazardPointer {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    explicit HazardPointer(HazardDomain& domain = HazardDomain::Global())
+        : domain_(domain), record_(domain.AcquireRecord()) {
+    }
+
+    HazardPointer(const HazardPointer&) = delete;
+    HazardPointer& operator=(const HazardPointer&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~HazardPointer() {
+        domain_.ReleaseRecord(record_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // The result stays valid until the next `Protect` or `Reset`, or the end of `*this`
+    template <typename T, typename Policy>
+    T* Protect(const HazardCell<T, Policy>& cell) {
+        assert(&cell.domain_ == &domain_);
+        T* ptr = cell.ptr_.load(std::memory_order_relaxed);
+        while (true) {
+            record_->ptr.store(ptr, std::memory_order_seq_cst);
+            // Still there after publishing: a writer replacing it now will see our hazard
+            T* again = cell.ptr_.load(std::memory_order_seq_cst);
+            if (again == ptr) {
+                return ptr;
+            }
+            ptr = again;
+        }
+    }
+
+    void Reset() {
+        record_->ptr.store(nullptr, std::memory_order_release);
+    }
+
+private:
+    HazardDomain& domain_;
+    HazardDomain::Record* record_;
+};
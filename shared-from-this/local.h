@@ -0,0 +1,89 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+// Shared ownership that never leaves the thread which created the object, like
+// boost::local_shared_ptr. Same interface and `MakeShared` layout as SharedPtr, with plain
+// (non-atomic) counts.
+//
+// LocalSharedPtr<Node> root = MakeLocalShared<Node>(...);
+//
+// With SMART_POINTERS_DEBUG_CHECKS defined the block remembers the creating thread and every count
+// change from any other one aborts. Without it the block is a bare ControlBlockBase and the checks
+// compile away. The macro changes the block layout, so like SMART_POINTERS_BLOCK_REGISTRY it has to
+// be the same in every translation unit (the CMake build sets it for the Debug configuration);
+// NDEBUG does not matter.
+
+#ifdef SMART_POINTERS_DEBUG_CHECKS
+struct LocalControlBlock : public ControlBlockBase {
+    std::thread::id owner = std::this_thread::get_id();
+};
+#endif
+
+struct LocalRefCount {
+#ifdef SMART_POINTERS_DEBUG_CHECKS
+    using Block = LocalControlBlock;
+#else
+    using Block = ControlBlockBase;
+#endif
+    static constexpr bool kExactUseCount = true;
+
+    static void IncStrong(ControlBlockBase* block) {
+        CheckThread(block);
+        NonAtomicRefCount::IncStrong(block);
+    }
+
+    static bool TryIncStrong(ControlBlockBase* block) {
+        CheckThread(block);
+        return NonAtomicRefCount::TryIncStrong(block);
+    }
+
+    static bool DecStrong(ControlBlockBase* block) {
+        CheckThread(block);
+        return NonAtomicRefCount::DecStrong(block);
+    }
+
+    static void IncWeak(ControlBlockBase* block) {
+        CheckThread(block);
+        NonAtomicRefCount::IncWeak(block);
+    }
+
+    static bool DecWeak(ControlBlockBase* block) {
+        CheckThread(block);
+        return NonAtomicRefCount::DecWeak(block);
+    }
+
+    static size_t UseCount(const ControlBlockBase* block) {
+        CheckThread(block);
+        return NonAtomicRefCount::UseCount(block);
+    }
+
+private:
+    static void CheckThread([[maybe_unused]] const ControlBlockBase* block) {
+#ifdef SMART_POINTERS_DEBUG_CHECKS
+        if (static_cast<const LocalControlBlock*>(block)->owner != std::this_thread::get_id()) {
+            std::fputs("LocalSharedPtr used outside of its thread\n", stderr);
+            std::abort();
+        }
+#endif
+    }
+};
+
+template <typename T>
+using LocalSharedPtr = SharedPtr<T, LocalRefCount>;
+
+template <typename T>
+using LocalWeakPtr = WeakPtr<T, LocalRefCount>;
+
+template <typename T>
+using EnableLocalSharedFromThis = EnableSharedFromThis<T, LocalRefCount>;
+
+template <typename T, typename... Args>
+LocalSharedPtr<T> MakeLocalShared(Args&&... args) {
+    return MakeShared<T, LocalRefCount>(std::forward<Args>(args)...);
+};
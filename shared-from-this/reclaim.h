@@ -0,0 +1,240 @@
+#pragma once
+
+#include "shared.h"
+#include "../unique/unique.h"  // DefaultDeleter
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Deferred reclamation: the last owner only queues the object, and the destructor runs later,
+// either on a background thread or in a time-sliced `Reclaimer::Drain(budget)` call. Destroying a
+// large object graph then no longer lands on whatever request dropped the last reference.
+//
+// Opt in per pointer type:
+//   SharedPtr<T, DeferredRefCount>, MakeShared<T, DeferredRefCount>(...)
+//   UniquePtr<T, DeferredDelete<T>>
+//
+// Objects reachable only through deferred pointers are queued in turn as their owner is
+// destroyed, so a graph is torn down over several slices rather than in one go.
+// Nothing is reclaimed unless somebody drains the queue or `StartBackground()` was called.
+
+class Reclaimer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        size_t queue_depth;
+        size_t enqueued;
+        size_t reclaimed;
+        // Time from the last reference to the destructor, for the last and the worst object
+        Clock::duration last_lag;
+        Clock::duration max_lag;
+    };
+
+    Reclaimer() = default;
+    Reclaimer(const Reclaimer&) = delete;
+    Reclaimer& operator=(const Reclaimer&) = delete;
+
+    ~Reclaimer() {
+        StopBackground();
+        Drain(Clock::duration::max());
+    }
+
+    // Leaked on purpose: pointers may be released after static destructors have run
+    static Reclaimer& Global() {
+        static auto reclaimer = new Reclaimer;
+        return *reclaimer;
+    }
+
+    void Push(void* object, void (*destroy)(void* object)) {
+        Item item{object, destroy, Clock::now()};
+        bool wake;
+        {
+            std::lock_guard guard(mutex_);
+            wake = background_ && queue_.empty();
+            queue_.push_back(item);
+        }
+        enqueued_.fetch_add(1, std::memory_order_relaxed);
+        if (wake) {
+            wakeup_.notify_one();
+        }
+    }
+
+    // Destroys queued objects until the queue is empty or `budget` is spent. The budget is checked
+    // between objects, so one expensive destructor may overrun it. Returns the number destroyed.
+    size_t Drain(Clock::duration budget) {
+        auto start = Clock::now();
+        auto deadline = budget >= Clock::time_point::max() - start ? Clock::time_point::max()
+                                                                    : start + budget;
+        size_t done = 0;
+        while (true) {
+            Item item;
+            {
+                std::lock_guard guard(mutex_);
+                if (queue_.empty()) {
+                    break;
+                }
+                item = queue_.front();
+                queue_.pop_front();
+            }
+            item.destroy(item.object);
+            ++done;
+
+            auto now = Clock::now();
+            Record(now - item.queued);
+            if (now >= deadline) {
+                break;
+            }
+        }
+        return done;
+    }
+
+    // Starts a thread that drains the queue in slices of `slice` whenever it is not empty
+    void StartBackground(Clock::duration slice = std::chrono::milliseconds(1)) {
+        std::lock_guard guard(mutex_);
+        if (background_) {
+            return;
+        }
+        stop_ = false;
+        background_ = true;
+        thread_ = std::thread([this, slice] { Run(slice); });
+    }
+
+    // The queue is left as it is, to be drained by the caller
+    void StopBackground() {
+        {
+            std::lock_guard guard(mutex_);
+            if (!background_) {
+                return;
+            }
+            stop_ = true;
+        }
+        wakeup_.notify_one();
+        thread_.join();
+        std::lock_guard guard(mutex_);
+        background_ = false;
+    }
+
+    Stats GetStats() const {
+        size_t depth;
+        {
+            std::lock_guard guard(mutex_);
+            depth = queue_.size();
+        }
+        return {depth, enqueued_.load(std::memory_order_relaxed),
+                reclaimed_.load(std::memory_order_relaxed),
+                Clock::duration(last_lag_.load(std::memory_order_relaxed)),
+                Clock::duration(max_lag_.load(std::memory_order_relaxed))};
+    }
+
+private:
+    struct Item {
+        void* object;
+        void (*destroy)(void* object);
+        Clock::time_point queued;
+    };
+
+    void Run(Clock::duration slice) {
+        std::unique_lock lock(mutex_);
+        while (true) {
+            wakeup_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (stop_) {
+                return;
+            }
+            lock.unlock();
+            Drain(slice);
+            // Let the threads that fill the queue in
+            std::this_thread::yield();
+            lock.lock();
+        }
+    }
+
+    void Record(Clock::duration lag) {
+        auto ticks = lag.count();
+        reclaimed_.fetch_add(1, std::memory_order_relaxed);
+        last_lag_.store(ticks, std::memory_order_relaxed);
+        auto max = max_lag_.load(std::memory_order_relaxed);
+        while (ticks > max &&
+               !max_lag_.compare_exchange_weak(max, ticks, std::memory_order_relaxed)) {
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::deque<Item> queue_;
+    std::thread thread_;
+    bool background_ = false;
+    bool stop_ = false;
+
+    std::atomic<size_t> enqueued_{0};
+    std::atomic<size_t> reclaimed_{0};
+    std::atomic<Clock::rep> last_lag_{0};
+    std::atomic<Clock::rep> max_lag_{0};
+};
+
+// Atomic counting whose last strong reference queues the object to `Reclaimer::Global()`.
+// The count stays at zero meanwhile, so `WeakPtr::Lock()` already fails.
+struct DeferredRefCount {
+    using Block = ControlBlockBase;
+    // Only the destruction is late, the count is not
+    static constexpr bool kExactUseCount = true;
+
+    static void IncStrong(ControlBlockBase* block) {
+        AtomicRefCount::IncStrong(block);
+    }
+
+    static bool TryIncStrong(ControlBlockBase* block) {
+        return AtomicRefCount::TryIncStrong(block);
+    }
+
+    // Never reports the last reference: the reclaimer finishes the block instead
+    static bool DecStrong(ControlBlockBase* block) {
+        if (AtomicRefCount::DecStrong(block)) {
+            Reclaimer::Global().Push(block, &Finish);
+        }
+        return false;
+    }
+
+    static void IncWeak(ControlBlockBase* block) {
+        AtomicRefCount::IncWeak(block);
+    }
+
+    static bool DecWeak(ControlBlockBase* block) {
+        return AtomicRefCount::DecWeak(block);
+    }
+
+    static size_t UseCount(const ControlBlockBase* block) {
+        return AtomicRefCount::UseCount(block);
+    }
+
+private:
+    static void Finish(void* block) {
+        ReleaseObject<DeferredRefCount>(static_cast<ControlBlockBase*>(block));
+    }
+};
+
+// Hands the pointer to `Reclaimer::Global()`, which later frees it with `Deleter`.
+// `Deleter` has to be default constructible: only the pointer is queued.
+template <typename T, typename Deleter = DefaultDeleter<T>>
+struct DeferredDelete {
+    DeferredDelete() = default;
+
+    template <typename S, typename SDeleter>
+    DeferredDelete(DeferredDelete<S, SDeleter>&&) {
+    }
+
+    void operator()(T* ptr) const {
+        if (ptr) {
+            Reclaimer::Global().Push(const_cast<std::remove_cv_t<T>*>(ptr), &Finish);
+        }
+    }
+
+private:
+    static void Finish(void* ptr) {
+        Deleter()(static_cast<T*>(ptr));
+    }
+};
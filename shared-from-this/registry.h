@@ -0,0 +1,239 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define SMART_POINTERS_HAS_BACKTRACE 1
+#endif
+
+// Registry of live control blocks, compiled in by shared.h with SMART_POINTERS_BLOCK_REGISTRY
+// defined (in every translation unit, since it changes the layout of ControlBlockBase).
+//
+// Every block records the type it owns, the call stack that created it, its creation time and
+// the peaks of its counters. `BlockRegistry::Dump` prints the blocks alive right now:
+//
+// BlockRegistry::Dump(std::cerr, BlockRegistry::kJson);
+// BlockRegistry::DumpAtExit(BlockRegistry::kText);
+//
+// The counters are printed raw, as the policy stores them (BiasedRefCount keeps other threads'
+// references shifted left by two, for example).
+
+// `int` for `TypeName<int>()`, from the signature the compiler puts in __PRETTY_FUNCTION__
+template <typename T>
+constexpr std::string_view TypeName() {
+    std::string_view name = __PRETTY_FUNCTION__;
+    auto begin = name.find("T = ");
+    if (begin == std::string_view::npos) {
+        return name;
+    }
+    begin += 4;
+    auto end = name.find(';', begin);
+    if (end == std::string_view::npos) {
+        end = name.rfind(']');
+    }
+    return name.substr(begin, end - begin);
+}
+
+class BlockRecord {
+public:
+    BlockRecord(const std::atomic<size_t>* strong, const std::atomic<size_t>* weak);
+    ~BlockRecord();
+
+    BlockRecord(const BlockRecord&) = delete;
+    BlockRecord& operator=(const BlockRecord&) = delete;
+
+    void SetType(std::string_view type) {
+        type_ = type;
+    }
+
+    void NoteStrong(size_t cnt) {
+        Raise(peak_strong_, cnt);
+    }
+
+    void NoteWeak(size_t cnt) {
+        Raise(peak_weak_, cnt);
+    }
+
+private:
+    static constexpr int kFrames = 6;
+
+    static void Raise(std::atomic<size_t>& peak, size_t cnt) {
+        size_t current = peak.load(std::memory_order_relaxed);
+        while (cnt > current &&
+               !peak.compare_exchange_weak(current, cnt, std::memory_order_relaxed)) {
+        }
+    }
+
+    const std::atomic<size_t>* strong_;
+    const std::atomic<size_t>* weak_;
+    std::string_view type_ = "?";
+    std::chrono::steady_clock::time_point created_ = std::chrono::steady_clock::now();
+    std::atomic<size_t> peak_strong_{1};
+    std::atomic<size_t> peak_weak_{1};
+    void* site_[kFrames];
+    int frames_ = 0;
+    BlockRecord* prev_ = nullptr;
+    BlockRecord* next_ = nullptr;
+
+    friend class BlockRegistry;
+};
+
+class BlockRegistry {
+public:
+    enum Format { kText, kJson };
+
+    static size_t LiveCount() {
+        std::lock_guard guard(Mutex());
+        return Live();
+    }
+
+    static void Dump(std::ostream& out, Format format = kText) {
+        std::lock_guard guard(Mutex());
+        auto now = std::chrono::steady_clock::now();
+        if (format == kText) {
+            out << "live control blocks: " << Live() << '\n';
+        } else {
+            out << "{\"live\": " << Live() << ", \"blocks\": [";
+        }
+        bool first = true;
+        for (auto record = Head(); record; record = record->next_) {
+            auto age = std::chrono::duration_cast<std::chrono::nanoseconds>(now - record->created_);
+            size_t strong = record->strong_->load(std::memory_order_relaxed);
+            size_t weak = record->weak_->load(std::memory_order_relaxed);
+            size_t peak_strong = record->peak_strong_.load(std::memory_order_relaxed);
+            size_t peak_weak = record->peak_weak_.load(std::memory_order_relaxed);
+            if (format == kText) {
+                out << "  " << record->type_ << ": strong " << strong << " (peak " << peak_strong
+                    << "), weak " << weak << " (peak " << peak_weak << "), age "
+                    << age.count() << " ns\n";
+                ForEachFrame(record, [&out](const char* frame) {
+                    out << "    at " << frame << '\n';
+                });
+            } else {
+                out << (first ? "" : ", ") << "{\"type\": ";
+                WriteJsonString(out, record->type_);
+                out << ", \"strong\": " << strong << ", \"peak_strong\": " << peak_strong
+                    << ", \"weak\": " << weak << ", \"peak_weak\": " << peak_weak
+                    << ", \"age_ns\": " << age.count() << ", \"site\": [";
+                bool first_frame = true;
+                ForEachFrame(record, [&out, &first_frame](const char* frame) {
+                    out << (first_frame ? "" : ", ");
+                    WriteJsonString(out, frame);
+                    first_frame = false;
+                });
+                out << "]}";
+            }
+            first = false;
+        }
+        if (format == kJson) {
+            out << "]}\n";
+        }
+    }
+
+    // Dumps to stderr when the program exits
+    static void DumpAtExit(Format format = kText);
+
+private:
+    static void Add(BlockRecord* record) {
+        std::lock_guard guard(Mutex());
+        record->next_ = Head();
+        if (Head()) {
+            Head()->prev_ = record;
+        }
+        Head() = record;
+        ++Live();
+    }
+
+    static void Remove(BlockRecord* record) {
+        std::lock_guard guard(Mutex());
+        if (record->prev_) {
+            record->prev_->next_ = record->next_;
+        } else {
+            Head() = record->next_;
+        }
+        if (record->next_) {
+            record->next_->prev_ = record->prev_;
+        }
+        --Live();
+    }
+
+    template <typename Callback>
+    static void ForEachFrame([[maybe_unused]] const BlockRecord* record,
+                             [[maybe_unused]] Callback callback) {
+#ifdef SMART_POINTERS_HAS_BACKTRACE
+        char** symbols = backtrace_symbols(record->site_, record->frames_);
+        if (!symbols) {
+            return;
+        }
+        for (int i = 0; i < record->frames_; ++i) {
+            callback(symbols[i]);
+        }
+        std::free(symbols);
+#endif
+    }
+
+    static void WriteJsonString(std::ostream& out, std::string_view text) {
+        out << '"';
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out << escaped;
+            } else {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+
+    // Leaked on purpose, blocks may die after static destructors have run
+    static std::mutex& Mutex() {
+        static auto mutex = new std::mutex;
+        return *mutex;
+    }
+
+    static BlockRecord*& Head() {
+        static BlockRecord* head = nullptr;
+        return head;
+    }
+
+    static size_t& Live() {
+        static size_t live = 0;
+        return live;
+    }
+
+    friend class BlockRecord;
+};
+
+inline BlockRecord::BlockRecord(const std::atomic<size_t>* strong, const std::atomic<size_t>* weak)
+    : strong_(strong), weak_(weak) {
+#ifdef SMART_POINTERS_HAS_BACKTRACE
+    // The first frame is this constructor
+    void* frames[kFrames + 1];
+    int count = backtrace(frames, kFrames + 1);
+    for (int i = 1; i < count; ++i) {
+        site_[frames_++] = frames[i];
+    }
+#endif
+    BlockRegistry::Add(this);
+}
+
+inline BlockRecord::~BlockRecord() {
+    BlockRegistry::Remove(this);
+}
+
+inline void BlockRegistry::DumpAtExit(Format format) {
+    static Format at_exit;
+    at_exit = format;
+    std::atexit([] { Dump(std::cerr, at_exit); });
+}
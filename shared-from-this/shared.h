@@ -2,104 +2,522 @@
 
 #include "sw_fwd.h"
 // #include "weak.h" // Forward declaration
+#include "block_pool.h"
+#include "../unique/compressed_pair.h"
+#ifdef SMART_POINTERS_BLOCK_REGISTRY
+#include "registry.h"
+#endif
 
+#include <atomic>
 #include <cstddef>  // std::nullptr_t
+#include <cstdint>  // SIZE_MAX
+#include <new>
 #include <type_traits>
 #include <memory>
 
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
 
+template <typename Policy>
 class BaseSharedFromThis {};
 
+struct ControlBlockBase;
+
+// Hand-made vtable, one per block type. No virtual destructor, and `delete_ptr` is nullptr when
+// there is nothing to destroy.
+struct ControlBlockOps {
+    void (*delete_ptr)(ControlBlockBase* block);
+    void (*destroy)(ControlBlockBase* block);
+};
+
 struct ControlBlockBase {
-    size_t strong_cnt = 1;
-    size_t weak_cnt = 0;
-    bool ptr_deleted = false;
-    virtual void DeletePtr() = 0;
-    virtual ~ControlBlockBase() = default;
+    // All strong references together hold one weak reference, so the object is destroyed
+    // exactly once (when `strong_cnt` drops to zero) and the block itself when `weak_cnt` does
+    std::atomic<size_t> strong_cnt{1};
+    std::atomic<size_t> weak_cnt{1};
+    const ControlBlockOps* ops = nullptr;
+#ifdef SMART_POINTERS_BLOCK_REGISTRY
+    BlockRecord record{&strong_cnt, &weak_cnt};
+#endif
+
+    void DeletePtr() {
+        if (ops->delete_ptr) {
+            ops->delete_ptr(this);
+        }
+    }
+
+    void Destroy() {
+        ops->destroy(this);
+    }
+
+#ifndef SMART_POINTERS_NO_BLOCK_POOL
+    // `new ControlBlock...` and `delete` of a block go through the slab allocator.
+    // Define SMART_POINTERS_NO_BLOCK_POOL to use the global heap instead.
+    static void* operator new(size_t size) {
+        return BlockPool::Allocate(size);
+    }
+
+    static void operator delete(void* ptr, size_t size) {
+        BlockPool::Deallocate(ptr, size);
+    }
+
+    // Over-aligned blocks bypass the pool
+    static void* operator new(size_t size, std::align_val_t align) {
+        return ::operator new(size, align);
+    }
+
+    static void operator delete(void* ptr, size_t size, std::align_val_t align) {
+        ::operator delete(ptr, size, align);
+    }
+#endif
 };
 
+// Hooks of the block registry, see registry.h. Empty without SMART_POINTERS_BLOCK_REGISTRY.
+inline void NoteStrong([[maybe_unused]] ControlBlockBase* block, [[maybe_unused]] size_t cnt) {
+#ifdef SMART_POINTERS_BLOCK_REGISTRY
+    block->record.NoteStrong(cnt);
+#endif
+}
+
+inline void NoteWeak([[maybe_unused]] ControlBlockBase* block, [[maybe_unused]] size_t cnt) {
+#ifdef SMART_POINTERS_BLOCK_REGISTRY
+    block->record.NoteWeak(cnt);
+#endif
+}
+
 template <typename T>
-struct ControlBlockPointer : public ControlBlockBase {
-    explicit ControlBlockPointer(T* ptr) : ptr_(ptr){};
-    T* ptr_;
+void NoteType([[maybe_unused]] ControlBlockBase* block) {
+#ifdef SMART_POINTERS_BLOCK_REGISTRY
+    block->record.SetType(TypeName<T>());
+#endif
+}
+
+// Raw memory for blocks whose size is only known at run time, taken from the same place
+// `new ControlBlock...` would take it
+inline void* AllocateBlockMemory(size_t size, size_t align) {
+    if (align > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        return ::operator new(size, std::align_val_t{align});
+    }
+#ifndef SMART_POINTERS_NO_BLOCK_POOL
+    static_assert(BlockPool::kGranule >= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    return BlockPool::Allocate(size);
+#else
+    return ::operator new(size);
+#endif
+}
+
+inline void DeallocateBlockMemory(void* ptr, size_t size, size_t align) {
+    if (align > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        ::operator delete(ptr, size, std::align_val_t{align});
+        return;
+    }
+#ifndef SMART_POINTERS_NO_BLOCK_POOL
+    BlockPool::Deallocate(ptr, size);
+#else
+    ::operator delete(ptr, size);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reference counting policies
+//
+// A policy is the second template argument of SharedPtr/WeakPtr and decides how the counts of
+// ControlBlockBase are touched. `DecStrong`/`DecWeak` return true for the last reference,
+// `Block` is the base every control block of the policy derives from.
+
+// Shared ownership never leaves one thread: relaxed loads and stores compile to plain memory
+// accesses, without a single locked instruction
+struct NonAtomicRefCount {
+    using Block = ControlBlockBase;
+    static constexpr bool kExactUseCount = true;
+
+    static void IncStrong(ControlBlockBase* block) {
+        NoteStrong(block, Add(block->strong_cnt, 1));
+    }
 
-    void DeletePtr() override {
-        if (!ptr_deleted) {
-            delete ptr_;
-            ptr_deleted = true;
+    static bool TryIncStrong(ControlBlockBase* block) {
+        if (block->strong_cnt.load(std::memory_order_relaxed) == 0) {
+            return false;
         }
+        NoteStrong(block, Add(block->strong_cnt, 1));
+        return true;
+    }
+
+    static bool DecStrong(ControlBlockBase* block) {
+        return Add(block->strong_cnt, -1) == 0;
+    }
+
+    static void IncWeak(ControlBlockBase* block) {
+        NoteWeak(block, Add(block->weak_cnt, 1));
+    }
+
+    static bool DecWeak(ControlBlockBase* block) {
+        return Add(block->weak_cnt, -1) == 0;
+    }
+
+    static size_t UseCount(const ControlBlockBase* block) {
+        return block->strong_cnt.load(std::memory_order_relaxed);
     }
-    ~ControlBlockPointer() override {
-        if (!ptr_deleted) {
-            delete ptr_;
+
+private:
+    static size_t Add(std::atomic<size_t>& cnt, size_t delta) {
+        size_t value = cnt.load(std::memory_order_relaxed) + delta;
+        cnt.store(value, std::memory_order_relaxed);
+        return value;
+    }
+};
+
+// Default policy: pointers to one object may be copied and destroyed from any thread
+struct AtomicRefCount {
+    using Block = ControlBlockBase;
+    static constexpr bool kExactUseCount = true;
+
+    // A new reference is always made from an existing one, nothing to synchronize with
+    static void IncStrong(ControlBlockBase* block) {
+        NoteStrong(block, block->strong_cnt.fetch_add(1, std::memory_order_relaxed) + 1);
+    }
+
+    // `WeakPtr::Lock`: never bring back an object whose count has already reached zero
+    static bool TryIncStrong(ControlBlockBase* block) {
+        size_t cnt = block->strong_cnt.load(std::memory_order_relaxed);
+        while (cnt != 0) {
+            if (block->strong_cnt.compare_exchange_weak(cnt, cnt + 1, std::memory_order_acq_rel,
+                                                        std::memory_order_relaxed)) {
+                NoteStrong(block, cnt + 1);
+                return true;
+            }
         }
+        return false;
+    }
+
+    // Every write to the object happens before its destruction in the thread that drops the
+    // last reference
+    static bool DecStrong(ControlBlockBase* block) {
+        return Release(block->strong_cnt);
+    }
+
+    static void IncWeak(ControlBlockBase* block) {
+        NoteWeak(block, block->weak_cnt.fetch_add(1, std::memory_order_relaxed) + 1);
+    }
+
+    static bool DecWeak(ControlBlockBase* block) {
+        return Release(block->weak_cnt);
+    }
+
+    // Acquire, so that `UseCount() == 1` can be trusted as "nobody else touches the object"
+    static size_t UseCount(const ControlBlockBase* block) {
+        return block->strong_cnt.load(std::memory_order_acquire);
+    }
+
+private:
+    // acq_rel instead of release plus an acquire fence on the last reference: the same code on
+    // x86, and ThreadSanitizer does not understand fences
+    static bool Release(std::atomic<size_t>& cnt) {
+        return cnt.fetch_sub(1, std::memory_order_acq_rel) == 1;
     }
 };
 
-template <typename T>
-struct ControlBlockEmplace : public ControlBlockBase {
+// Called by whoever drops the last strong reference. Kept out of line, so that the inlined
+// release in every destructor and assignment is just a decrement and a branch.
+template <typename Policy>
+[[gnu::noinline, gnu::cold]] void ReleaseObject(ControlBlockBase* block) {
+    block->DeletePtr();
+    if (Policy::DecWeak(block)) {
+        block->Destroy();
+    }
+}
+
+// A policy may also define `static void Adopt(ControlBlockBase* block, Y* ptr)` to learn the
+// type of the object when a block takes ownership of it
+template <typename Policy, typename Y, typename = void>
+inline constexpr bool kHasAdoptHook = false;
+
+template <typename Policy, typename Y>
+inline constexpr bool kHasAdoptHook<
+    Policy, Y,
+    std::void_t<decltype(Policy::Adopt(std::declval<ControlBlockBase*>(), std::declval<Y*>()))>> =
+    true;
+
+// ... and `static constexpr bool kExactUseCount = true` when `UseCount()` counts every owner, so
+// that `UseCount() == 1` proves the asking pointer is the only one. Whatever edits an object in
+// place on that proof (CowPtr, the persistent containers) requires it.
+template <typename Policy, typename = void>
+inline constexpr bool kHasExactUseCount = false;
+
+template <typename Policy>
+inline constexpr bool
+    kHasExactUseCount<Policy, std::void_t<decltype(Policy::kExactUseCount)>> =
+        Policy::kExactUseCount;
+
+// ... and `static void Moved(ControlBlockBase* block)` to learn that a strong reference changed
+// place without a count change: moves and swaps
+template <typename Policy, typename = void>
+inline constexpr bool kHasMovedHook = false;
+
+template <typename Policy>
+inline constexpr bool
+    kHasMovedHook<Policy, std::void_t<decltype(Policy::Moved(std::declval<ControlBlockBase*>()))>> =
+        true;
+
+// `T` is `Y[]` for a pointer that came from `new Y[n]`
+template <typename T, typename Base = ControlBlockBase>
+struct ControlBlockPointer : public Base {
+    using Element = std::remove_extent_t<T>;
+
+    explicit ControlBlockPointer(Element* ptr) : ptr_(ptr) {
+        this->ops = &kOps;
+    };
+    Element* ptr_;
+
+    static void DeletePtr(ControlBlockBase* block) {
+        if constexpr (std::is_array_v<T>) {
+            delete[] static_cast<ControlBlockPointer*>(block)->ptr_;
+        } else {
+            delete static_cast<ControlBlockPointer*>(block)->ptr_;
+        }
+    }
+
+    static void Destroy(ControlBlockBase* block) {
+        delete static_cast<ControlBlockPointer*>(block);
+    }
+
+    static constexpr ControlBlockOps kOps = {&DeletePtr, &Destroy};
+};
+
+// `MakeSharedForOverwrite`: default-initialize instead of value-initialize
+struct ForOverwriteTag {};
+
+// Not std::hardware_destructive_interference_size: its value may differ between translation units
+inline constexpr size_t kCacheLineSize = 64;
+
+// `Align` above alignof(T) starts the object on a fresh cache line, see `MakeSharedPadded`.
+// Over-aligned blocks are allocated with the aligned `operator new`.
+template <typename T, typename Base = ControlBlockBase, size_t Align = alignof(T)>
+struct ControlBlockEmplace : public Base {
     template <typename... Args>
     explicit ControlBlockEmplace(Args&&... args) {
         new (&storage_) T{std::forward<Args>(args)...};
+        this->ops = &kOps;
+    };
+
+    explicit ControlBlockEmplace(ForOverwriteTag) {
+        new (&storage_) T;
+        this->ops = &kOps;
     };
 
-    void DeletePtr() override {
-        if (!ptr_deleted) {
-            std::destroy_at(std::launder(reinterpret_cast<T*>(&storage_)));
-            ptr_deleted = true;
+    static void DeletePtr(ControlBlockBase* block) {
+        auto self = static_cast<ControlBlockEmplace*>(block);
+        std::destroy_at(std::launder(reinterpret_cast<T*>(&self->storage_)));
+    }
+
+    static void Destroy(ControlBlockBase* block) {
+        delete static_cast<ControlBlockEmplace*>(block);
+    }
+
+    // Trivially destructible objects are simply forgotten
+    static constexpr ControlBlockOps kOps = {
+        std::is_trivially_destructible_v<T> ? nullptr : &DeletePtr, &Destroy};
+
+    alignas(Align) unsigned char storage_[sizeof(T)];
+};
+
+// `SharedPtr(ptr, deleter, alloc)`: the block itself is allocated with `Alloc`
+// Stateless deleters and allocators take no space: the pair is an empty base then
+template <typename T, typename Deleter, typename Alloc, typename Base = ControlBlockBase>
+struct ControlBlockDeleter : public Base, private CompressedPair<Deleter, Alloc> {
+    using BlockAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<ControlBlockDeleter>;
+    using Pair = CompressedPair<Deleter, Alloc>;
+
+    ControlBlockDeleter(T* ptr, Deleter deleter, Alloc alloc)
+        : Pair(std::move(deleter), std::move(alloc)), ptr_(ptr) {
+        this->ops = &kOps;
+    }
+
+    // Frees `ptr` with `deleter` if the block cannot be allocated
+    static ControlBlockDeleter* Create(T* ptr, Deleter deleter, Alloc alloc) {
+        BlockAlloc block_alloc(alloc);
+        ControlBlockDeleter* memory;
+        try {
+            memory = std::allocator_traits<BlockAlloc>::allocate(block_alloc, 1);
+        } catch (...) {
+            deleter(ptr);
+            throw;
+        }
+        return ::new (memory) ControlBlockDeleter(ptr, std::move(deleter), std::move(alloc));
+    }
+
+    static void DeletePtr(ControlBlockBase* block) {
+        auto self = static_cast<ControlBlockDeleter*>(block);
+        self->GetFirst()(self->ptr_);
+    }
+
+    static void Destroy(ControlBlockBase* block) {
+        auto self = static_cast<ControlBlockDeleter*>(block);
+        BlockAlloc block_alloc(self->GetSecond());
+        self->~ControlBlockDeleter();
+        std::allocator_traits<BlockAlloc>::deallocate(block_alloc, self, 1);
+    }
+
+    static constexpr ControlBlockOps kOps = {&DeletePtr, &Destroy};
+
+    T* ptr_;
+};
+
+// `AllocateShared`: a `ControlBlockEmplace` living in memory from `Alloc`
+template <typename T, typename Alloc, typename Base = ControlBlockBase>
+struct ControlBlockAllocEmplace : public ControlBlockEmplace<T, Base>,
+                                  private CommpressedPairElement<Alloc, 0> {
+    using BlockAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<ControlBlockAllocEmplace>;
+    using Allocator = CommpressedPairElement<Alloc, 0>;
+
+    template <typename... Args>
+    explicit ControlBlockAllocEmplace(const Alloc& alloc, Args&&... args)
+        : ControlBlockEmplace<T, Base>(std::forward<Args>(args)...), Allocator(alloc) {
+        this->ops = &kOps;
+    }
+
+    template <typename... Args>
+    static ControlBlockAllocEmplace* Create(const Alloc& alloc, Args&&... args) {
+        BlockAlloc block_alloc(alloc);
+        auto memory = std::allocator_traits<BlockAlloc>::allocate(block_alloc, 1);
+        try {
+            return ::new (memory) ControlBlockAllocEmplace(alloc, std::forward<Args>(args)...);
+        } catch (...) {
+            std::allocator_traits<BlockAlloc>::deallocate(block_alloc, memory, 1);
+            throw;
         }
     }
 
-    ~ControlBlockEmplace() override {
-        if (!ptr_deleted) {
-            std::destroy_at(std::launder(reinterpret_cast<T*>(&storage_)));
+    static void Destroy(ControlBlockBase* block) {
+        auto self = static_cast<ControlBlockAllocEmplace*>(block);
+        BlockAlloc block_alloc(self->Allocator::GetElement());
+        self->~ControlBlockAllocEmplace();
+        std::allocator_traits<BlockAlloc>::deallocate(block_alloc, self, 1);
+    }
+
+    static constexpr ControlBlockOps kOps = {ControlBlockEmplace<T, Base>::kOps.delete_ptr,
+                                             &Destroy};
+};
+
+// `MakeShared<T[]>`: `size_` elements follow the block in the same allocation
+template <typename T, typename Base = ControlBlockBase>
+struct ControlBlockArray : public Base {
+    explicit ControlBlockArray(size_t size) : size_(size) {
+        this->ops = &kOps;
+    }
+
+    // `init(where)` constructs one element. If it throws, the ones already built are destroyed
+    // and the memory is freed. A size whose bytes do not fit in size_t throws
+    // std::bad_array_new_length, as `std::make_shared<T[]>` does.
+    template <typename Init>
+    static ControlBlockArray* Create(size_t size, Init init) {
+        if (size > (SIZE_MAX - Offset()) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        void* memory = AllocateBlockMemory(AllocSize(size), kAlign);
+        auto block = ::new (memory) ControlBlockArray(size);
+        T* data = block->Data();
+        size_t i = 0;
+        try {
+            for (; i < size; ++i) {
+                init(data + i);
+            }
+        } catch (...) {
+            std::destroy_n(std::make_reverse_iterator(data + i), i);
+            block->~ControlBlockArray();
+            DeallocateBlockMemory(memory, AllocSize(size), kAlign);
+            throw;
         }
+        return block;
+    }
+
+    T* Data() {
+        return std::launder(reinterpret_cast<T*>(reinterpret_cast<char*>(this) + Offset()));
+    }
+
+    // Elements are destroyed in reverse order, like `delete[]` does
+    static void DeletePtr(ControlBlockBase* block) {
+        auto self = static_cast<ControlBlockArray*>(block);
+        std::destroy_n(std::make_reverse_iterator(self->Data() + self->size_), self->size_);
+    }
+
+    static void Destroy(ControlBlockBase* block) {
+        auto self = static_cast<ControlBlockArray*>(block);
+        size_t size = self->size_;
+        self->~ControlBlockArray();
+        DeallocateBlockMemory(self, AllocSize(size), kAlign);
+    }
+
+    static constexpr ControlBlockOps kOps = {
+        std::is_trivially_destructible_v<T> ? nullptr : &DeletePtr, &Destroy};
+
+    size_t size_;
+
+private:
+    static constexpr size_t kAlign = alignof(T) > alignof(Base) ? alignof(T) : alignof(Base);
+
+    static constexpr size_t Offset() {
+        return (sizeof(ControlBlockArray) + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+
+    static size_t AllocSize(size_t size) {
+        return Offset() + size * sizeof(T);
     }
-    std::aligned_storage_t<sizeof(T), alignof(T)> storage_;
 };
 
-template <typename T>
+template <typename T, typename Policy>
 class SharedPtr {
 public:
+    // `U` for both `SharedPtr<U>` and `SharedPtr<U[]>`
+    using ElementType = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
     SharedPtr(){};
     SharedPtr(std::nullptr_t) {
     }
-    explicit SharedPtr(T* ptr) {
-        block_ = new ControlBlockPointer(ptr);
+    explicit SharedPtr(ElementType* ptr) {
+        block_ = NewPointerBlock(ptr);
         ptr_ = ptr;
-        if constexpr (std::is_convertible_v<T*, BaseSharedFromThis*>) {
-            ptr_->block_ = block_;
-            ptr_->ptr_ = ptr;
-        }
+        Adopt(ptr);
     };
 
     template <typename Y>
     explicit SharedPtr(Y* ptr) {
-        block_ = new ControlBlockPointer(ptr);
+        block_ = NewPointerBlock(ptr);
         ptr_ = ptr;
-        if constexpr (std::is_convertible_v<Y*, BaseSharedFromThis*>) {
-            ptr_->block_ = block_;
-            ptr_->ptr_ = ptr_;
-        }
+        Adopt(ptr);
     };
 
+    // #4 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
+    template <typename Y, typename Deleter>
+    SharedPtr(Y* ptr, Deleter deleter) : SharedPtr(ptr, std::move(deleter), std::allocator<Y>()) {
+    }
+
+    // #6 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
+    template <typename Y, typename Deleter, typename Alloc>
+    SharedPtr(Y* ptr, Deleter deleter, Alloc alloc) {
+        block_ = ControlBlockDeleter<Y, Deleter, Alloc, typename Policy::Block>::Create(
+            ptr, std::move(deleter), std::move(alloc));
+        ptr_ = ptr;
+        Adopt(ptr);
+    }
+
     SharedPtr(const SharedPtr& other) {
         block_ = other.block_;
         if (block_) {
-            block_->strong_cnt++;
+            Policy::IncStrong(block_);
         }
         ptr_ = other.ptr_;
     };
 
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other) {
+    SharedPtr(const SharedPtr<Y, Policy>& other) {
         block_ = other.GetBlock();
         if (block_) {
-            block_->strong_cnt++;
+            Policy::IncStrong(block_);
         }
         ptr_ = other.Get();
     };
@@ -109,30 +527,36 @@ public:
         ptr_ = other.ptr_;
         other.block_ = nullptr;
         other.ptr_ = nullptr;
+        NoteMoved(block_);
     };
 
     template <typename Y>
-    SharedPtr(SharedPtr<Y>&& other) {
-        block_ = other.GetBlock();
-        ptr_ = other.Get();
-        block_->strong_cnt++;
-        other.Reset();
+    SharedPtr(SharedPtr<Y, Policy>&& other) {
+        block_ = other.block_;
+        ptr_ = other.ptr_;
+        other.block_ = nullptr;
+        other.ptr_ = nullptr;
+        NoteMoved(block_);
     };
 
-    SharedPtr(ControlBlockEmplace<T>* block) {
+    template <size_t Align>
+    SharedPtr(ControlBlockEmplace<T, typename Policy::Block, Align>* block) {
         block_ = block;
         ptr_ = std::launder(reinterpret_cast<T*>(&block->storage_));
-        if constexpr (std::is_convertible_v<T*, BaseSharedFromThis*>) {
-            ptr_->block_ = block_;
-            ptr_->ptr_ = ptr_;
-        }
+        Adopt(ptr_);
+    }
+
+    SharedPtr(ControlBlockArray<ElementType, typename Policy::Block>* block) {
+        block_ = block;
+        ptr_ = block->Data();
+        NoteType<T>(block_);
     }
 
-    SharedPtr(ControlBlockBase* block, T* ptr) {
+    SharedPtr(ControlBlockBase* block, ElementType* ptr) {
         block_ = block;
         ptr_ = ptr;
         if (block_) {
-            block_->strong_cnt++;
+            Policy::IncStrong(block_);
         }
     }
 
@@ -145,23 +569,20 @@ public:
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) {
+    SharedPtr(const SharedPtr<Y, Policy>& other, ElementType* ptr) {
         ptr_ = ptr;
         if (other.GetBlock()) {
             block_ = other.GetBlock();
-            block_->strong_cnt++;
+            Policy::IncStrong(block_);
         }
     };
 
     // Promote `WeakPtr`
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
-    explicit SharedPtr(const WeakPtr<T>& other) {
-        if (other.UseCount()) {
+    explicit SharedPtr(const WeakPtr<T, Policy>& other) {
+        if (other.block_ && Policy::TryIncStrong(other.block_)) {
             block_ = other.block_;
             ptr_ = other.ptr_;
-            if (block_) {
-                ++block_->strong_cnt;
-            }
         } else {
             throw BadWeakPtr();
         }
@@ -172,39 +593,24 @@ public:
 
     SharedPtr& operator=(const SharedPtr& other) {
         if (this != &other) {
-            if (block_) {
-                --block_->strong_cnt;
-                if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                    delete block_;
-                } else if (block_->strong_cnt == 0) {
-                    block_->DeletePtr();
-                    ptr_ = nullptr;
-                }
+            if (other.block_) {
+                Policy::IncStrong(other.block_);
             }
+            Release();
             ptr_ = other.ptr_;
             block_ = other.block_;
-            if (block_) {
-                block_->strong_cnt++;
-            }
         }
         return *this;
     };
 
     SharedPtr& operator=(SharedPtr&& other) {
         if (this != &other) {
-            if (block_) {
-                --block_->strong_cnt;
-                if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                    delete block_;
-                } else if (block_->strong_cnt == 0) {
-                    block_->DeletePtr();
-                    ptr_ = nullptr;
-                }
-            }
+            Release();
             block_ = other.block_;
             other.block_ = nullptr;
             ptr_ = other.ptr_;
             other.ptr_ = nullptr;
+            NoteMoved(block_);
         }
         return *this;
     };
@@ -213,66 +619,43 @@ public:
     // Destructor
 
     ~SharedPtr() {
-        if (block_) {
-            --block_->strong_cnt;
-            if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                delete block_;
-            } else if (block_->strong_cnt == 0) {
-                block_->DeletePtr();
-                ptr_ = nullptr;
-            }
-        }
+        Release();
     };
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Modifiers
 
     void Reset() {
-        if (block_) {
-            --block_->strong_cnt;
-            if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                delete block_;
-            } else if (block_->strong_cnt == 0) {
-                block_->DeletePtr();
-                ptr_ = nullptr;
-            }
-        }
+        Release();
         block_ = nullptr;
         ptr_ = nullptr;
     };
 
-    void Reset(T* ptr) {
-        if (block_) {
-            --block_->strong_cnt;
-            if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                delete block_;
-            } else if (block_->strong_cnt == 0) {
-                block_->DeletePtr();
-                ptr_ = nullptr;
-            }
-        }
-        block_ = new ControlBlockPointer<T>(ptr);
-        ptr_ = ptr;
+    // The new pointer is made first: if that throws, `ptr` is deleted and this one is unchanged
+    void Reset(ElementType* ptr) {
+        SharedPtr(ptr).Swap(*this);
     };
 
     template <typename Y>
     void Reset(Y* ptr) {
-        if (block_) {
-            --block_->strong_cnt;
-            if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                delete block_;
-            } else if (block_->strong_cnt == 0) {
-                block_->DeletePtr();
-                ptr_ = nullptr;
-            }
-        }
-        block_ = new ControlBlockPointer<Y>(ptr);
-        ptr_ = ptr;
+        SharedPtr(ptr).Swap(*this);
+    };
+
+    template <typename Y, typename Deleter>
+    void Reset(Y* ptr, Deleter deleter) {
+        SharedPtr(ptr, std::move(deleter)).Swap(*this);
+    };
+
+    template <typename Y, typename Deleter, typename Alloc>
+    void Reset(Y* ptr, Deleter deleter, Alloc alloc) {
+        SharedPtr(ptr, std::move(deleter), std::move(alloc)).Swap(*this);
     };
 
     void Swap(SharedPtr& other) {
         std::swap(block_, other.block_);
         std::swap(ptr_, other.ptr_);
+        NoteMoved(block_);
+        NoteMoved(other.block_);
     };
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -292,11 +675,11 @@ public:
         return nullptr;
     };
 
-    T* Get() const {
+    ElementType* Get() const {
         return ptr_;
     };
 
-    T* Get() {
+    ElementType* Get() {
         return ptr_;
     };
 
@@ -304,13 +687,18 @@ public:
         return *ptr_;
     };
 
-    T* operator->() const {
+    ElementType* operator->() const {
         return ptr_;
     };
 
+    // Only for `SharedPtr<U[]>` and `SharedPtr<U[N]>`
+    ElementType& operator[](std::ptrdiff_t idx) const {
+        return ptr_[idx];
+    };
+
     size_t UseCount() const {
         if (block_) {
-            return block_->strong_cnt;
+            return Policy::UseCount(block_);
         }
         return 0;
     };
@@ -320,45 +708,262 @@ public:
     };
 
 private:
+    // `SharedPtr<U[]>(new U[n])` frees with `delete[]`
+    template <typename Y>
+    using PointerBlock =
+        ControlBlockPointer<std::conditional_t<std::is_array_v<T>, Y[], Y>, typename Policy::Block>;
+
+    // Frees `ptr` if the block cannot be allocated, as std::shared_ptr does
+    template <typename Y>
+    static ControlBlockBase* NewPointerBlock(Y* ptr) {
+        try {
+            return new PointerBlock<Y>(ptr);
+        } catch (...) {
+            if constexpr (std::is_array_v<T>) {
+                delete[] ptr;
+            } else {
+                delete ptr;
+            }
+            throw;
+        }
+    }
+
+    // Called once by the pointer that creates the block for `ptr`. Its constructor has not
+    // finished yet, so if a hook throws nobody else would release the object and the block.
+    template <typename Y>
+    void Adopt(Y* ptr) {
+        try {
+            NoteType<std::conditional_t<std::is_array_v<T>, T, Y>>(block_);
+            LinkSharedFromThis(ptr);
+            if constexpr (kHasAdoptHook<Policy, Y>) {
+                Policy::Adopt(block_, ptr);
+            }
+        } catch (...) {
+            Release();
+            throw;
+        }
+    }
+
+    template <typename Y>
+    void LinkSharedFromThis(Y* ptr) {
+        if constexpr (!std::is_array_v<T> &&
+                      std::is_convertible_v<Y*, BaseSharedFromThis<Policy>*>) {
+            // An object already owned elsewhere keeps its first owner
+            if (ptr && !ptr->block_) {
+                ptr->block_ = block_;
+                Policy::IncWeak(block_);
+            }
+        }
+    }
+
+    static void NoteMoved(ControlBlockBase* block) {
+        if constexpr (kHasMovedHook<Policy>) {
+            if (block) {
+                Policy::Moved(block);
+            }
+        }
+    }
+
+    // Drops the reference held by `*this`, fields are left for the caller to overwrite
+    void Release() {
+        if (block_ && Policy::DecStrong(block_)) {
+            ReleaseObject<Policy>(block_);
+        }
+    }
+
     ControlBlockBase* block_ = nullptr;
-    T* ptr_ = nullptr;
+    ElementType* ptr_ = nullptr;
+
+    template <typename Y, typename P>
+    friend class SharedPtr;
+    template <typename Y, typename P>
+    friend class WeakPtr;
+    template <typename Pointer>
+    friend struct AtomicCellRefs;
+    friend class HazardDomain;
+    template <typename Y, typename P>
+    friend class EnableSharedFromThis;
 };
 
-template <typename T, typename U>
-inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right) {
-    if (left.GetBlock() && right.GetBlock()) {
-        return left.Get() == right.Get();
-    }
+template <typename T, typename U, typename Policy>
+inline bool operator==(const SharedPtr<T, Policy>& left, const SharedPtr<U, Policy>& right) {
+    return left.Get() == right.Get();
 };
 
+// The object and the block in two allocations, like `SharedPtr(new T(...))`: once the last strong
+// reference is gone, the remaining weak ones hold only the counters
+template <typename T, typename Policy = AtomicRefCount, typename... Args>
+std::enable_if_t<!std::is_array_v<T>, SharedPtr<T, Policy>> MakeSharedSplit(Args&&... args) {
+    // The constructor owns `ptr` from the start: it frees it when the block cannot be allocated,
+    // and both of them when adopting throws
+    return SharedPtr<T, Policy>(new T{std::forward<Args>(args)...});
+};
+
+// `MakeShared` of objects at least this large switches to `MakeSharedSplit`.
+// Off unless SMART_POINTERS_SPLIT_THRESHOLD is defined.
+#ifdef SMART_POINTERS_SPLIT_THRESHOLD
+inline constexpr size_t kMakeSharedSplitThreshold = SMART_POINTERS_SPLIT_THRESHOLD;
+#else
+inline constexpr size_t kMakeSharedSplitThreshold = SIZE_MAX;
+#endif
+
 // Allocate memory only once
-template <typename T, typename... Args>
-SharedPtr<T> MakeShared(Args&&... args) {
-    auto block = new ControlBlockEmplace<T>(std::forward<Args>(args)...);
-    return SharedPtr<T>(block);
+template <typename T, typename Policy = AtomicRefCount, typename... Args>
+std::enable_if_t<!std::is_array_v<T>, SharedPtr<T, Policy>> MakeShared(Args&&... args) {
+    if constexpr (sizeof(T) >= kMakeSharedSplitThreshold) {
+        return MakeSharedSplit<T, Policy>(std::forward<Args>(args)...);
+    } else {
+        auto block =
+            new ControlBlockEmplace<T, typename Policy::Block>(std::forward<Args>(args)...);
+        return SharedPtr<T, Policy>(block);
+    }
+};
+
+// Arrays: `MakeShared<U[]>(n)`, `MakeShared<U[N]>()`, optionally with a value to copy into every
+// element. The elements live right after the control block.
+template <typename T, typename Policy = AtomicRefCount, typename Init>
+SharedPtr<T, Policy> MakeSharedArray(size_t size, Init init) {
+    using Block = ControlBlockArray<std::remove_extent_t<T>, typename Policy::Block>;
+    return SharedPtr<T, Policy>(Block::Create(size, init));
 };
 
-// Look for usage examples in tests and seminar
 template <typename T>
-class EnableSharedFromThis : public BaseSharedFromThis {
+inline constexpr bool kIsUnboundedArray = std::is_array_v<T> && std::extent_v<T> == 0;
+
+template <typename T>
+inline constexpr bool kIsBoundedArray = std::is_array_v<T> && std::extent_v<T> != 0;
+
+template <typename T, typename Policy = AtomicRefCount>
+std::enable_if_t<kIsUnboundedArray<T>, SharedPtr<T, Policy>> MakeShared(size_t size) {
+    using U = std::remove_extent_t<T>;
+    return MakeSharedArray<T, Policy>(size, [](U* where) { ::new (where) U(); });
+};
+
+template <typename T, typename Policy = AtomicRefCount>
+std::enable_if_t<kIsUnboundedArray<T>, SharedPtr<T, Policy>> MakeShared(
+    size_t size, const std::remove_extent_t<T>& value) {
+    using U = std::remove_extent_t<T>;
+    return MakeSharedArray<T, Policy>(size, [&value](U* where) { ::new (where) U(value); });
+};
+
+template <typename T, typename Policy = AtomicRefCount>
+std::enable_if_t<kIsBoundedArray<T>, SharedPtr<T, Policy>> MakeShared() {
+    return MakeShared<std::remove_extent_t<T>[], Policy>(std::extent_v<T>);
+};
+
+template <typename T, typename Policy = AtomicRefCount>
+std::enable_if_t<kIsBoundedArray<T>, SharedPtr<T, Policy>> MakeShared(
+    const std::remove_extent_t<T>& value) {
+    return MakeShared<std::remove_extent_t<T>[], Policy>(std::extent_v<T>, value);
+};
+
+// Default-initialized: no zeroing of trivial types that are about to be overwritten anyway
+template <typename T, typename Policy = AtomicRefCount>
+std::enable_if_t<!std::is_array_v<T>, SharedPtr<T, Policy>> MakeSharedForOverwrite() {
+    return SharedPtr<T, Policy>(
+        new ControlBlockEmplace<T, typename Policy::Block>(ForOverwriteTag{}));
+};
+
+template <typename T, typename Policy = AtomicRefCount>
+std::enable_if_t<kIsUnboundedArray<T>, SharedPtr<T, Policy>> MakeSharedForOverwrite(
+    size_t size) {
+    using U = std::remove_extent_t<T>;
+    return MakeSharedArray<T, Policy>(size, [](U* where) { ::new (where) U; });
+};
+
+template <typename T, typename Policy = AtomicRefCount>
+std::enable_if_t<kIsBoundedArray<T>, SharedPtr<T, Policy>> MakeSharedForOverwrite() {
+    return MakeSharedForOverwrite<std::remove_extent_t<T>[], Policy>(std::extent_v<T>);
+};
+
+// The counts and the object on separate cache lines: threads copying the pointer do not slow
+// down the one writing the object, at the price of a larger block
+template <typename T, typename Policy = AtomicRefCount, typename... Args>
+std::enable_if_t<!std::is_array_v<T>, SharedPtr<T, Policy>> MakeSharedPadded(Args&&... args) {
+    constexpr size_t kAlign = alignof(T) > kCacheLineSize ? alignof(T) : kCacheLineSize;
+    auto block = new ControlBlockEmplace<T, typename Policy::Block, kAlign>(
+        std::forward<Args>(args)...);
+    return SharedPtr<T, Policy>(block);
+};
+
+// Same single allocation, but the block comes from `alloc`
+template <typename T, typename Policy = AtomicRefCount, typename Alloc, typename... Args>
+SharedPtr<T, Policy> AllocateShared(const Alloc& alloc, Args&&... args) {
+    using Block = ControlBlockAllocEmplace<T, Alloc, typename Policy::Block>;
+    ControlBlockEmplace<T, typename Policy::Block>* block =
+        Block::Create(alloc, std::forward<Args>(args)...);
+    return SharedPtr<T, Policy>(block);
+};
+
+// Look for usage examples in tests and seminar
+//
+// The object holds one weak reference to its control block, set by the first SharedPtr that
+// owns it, and nothing else: `this` already is the pointer. So the block outlives the object, and
+// `SharedFromThis()` is a `WeakPtr::Lock()` that can tell an owned object from a dead one.
+template <typename T, typename Policy = AtomicRefCount>
+class EnableSharedFromThis : public BaseSharedFromThis<Policy> {
 public:
-    SharedPtr<T> SharedFromThis() {
-        return SharedPtr<T>(block_, ptr_);
+    // Throws BadWeakPtr if no SharedPtr owns the object (any more)
+    SharedPtr<T, Policy> SharedFromThis() {
+        return Checked(TryShared());
     };
-    SharedPtr<const T> SharedFromThis() const {
-        return SharedPtr<T>(block_, ptr_);
+    SharedPtr<const T, Policy> SharedFromThis() const {
+        return Checked(TryShared());
     };
 
-    WeakPtr<T> WeakFromThis() noexcept {
-        return WeakPtr<T>(block_, ptr_);
+    // Empty instead of throwing
+    SharedPtr<T, Policy> TryShared() noexcept {
+        return Lock<T>(static_cast<T*>(this));
     };
-    WeakPtr<const T> WeakFromThis() const noexcept {
-        return WeakPtr<const T>(block_, ptr_);
+    SharedPtr<const T, Policy> TryShared() const noexcept {
+        return Lock<const T>(static_cast<const T*>(this));
     };
 
+    WeakPtr<T, Policy> WeakFromThis() noexcept {
+        return WeakPtr<T, Policy>(block_, block_ ? static_cast<T*>(this) : nullptr);
+    };
+    WeakPtr<const T, Policy> WeakFromThis() const noexcept {
+        return WeakPtr<const T, Policy>(block_, block_ ? static_cast<const T*>(this) : nullptr);
+    };
+
+protected:
+    EnableSharedFromThis() {
+    }
+
+    // A copy is a different object, not owned by anybody yet
+    EnableSharedFromThis(const EnableSharedFromThis&) {
+    }
+
+    EnableSharedFromThis& operator=(const EnableSharedFromThis&) {
+        return *this;
+    }
+
+    ~EnableSharedFromThis() {
+        if (block_ && Policy::DecWeak(block_)) {
+            block_->Destroy();
+        }
+    }
+
 private:
+    template <typename U>
+    SharedPtr<U, Policy> Lock(U* self) const {
+        SharedPtr<U, Policy> result;
+        if (block_ && Policy::TryIncStrong(block_)) {
+            result.block_ = block_;
+            result.ptr_ = self;
+        }
+        return result;
+    }
+
+    template <typename U>
+    static SharedPtr<U, Policy> Checked(SharedPtr<U, Policy> result) {
+        if (!result) {
+            throw BadWeakPtr();
+        }
+        return result;
+    }
+
     ControlBlockBase* block_ = nullptr;
-    T* ptr_ = nullptr;
-    template <typename Y>
+    template <typename Y, typename P>
     friend class SharedPtr;
 };
@@ -4,9 +4,11 @@
 #include "shared.h"  // Forward declaration
 
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
-template <typename T>
+template <typename T, typename Policy>
 class WeakPtr {
 public:
+    using ElementType = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -15,7 +17,7 @@ public:
     WeakPtr(const WeakPtr& other) {
         block_ = other.block_;
         if (block_) {
-            block_->weak_cnt++;
+            Policy::IncWeak(block_);
         }
         ptr_ = other.ptr_;
     };
@@ -28,19 +30,19 @@ public:
 
     // Demote `SharedPtr`
     // #2 from https://en.cppreference.com/w/cpp/memory/weak_ptr/weak_ptr
-    WeakPtr(const SharedPtr<T>& other) {
+    WeakPtr(const SharedPtr<T, Policy>& other) {
         block_ = other.GetBlock();
         if (block_) {
-            block_->weak_cnt++;
+            Policy::IncWeak(block_);
         }
         ptr_ = other.Get();
     };
 
-    WeakPtr(ControlBlockBase* block, T* ptr) {
+    WeakPtr(ControlBlockBase* block, ElementType* ptr) {
         block_ = block;
         ptr_ = ptr;
         if (block_) {
-            block_->weak_cnt++;
+            Policy::IncWeak(block_);
         }
     }
 
@@ -49,33 +51,19 @@ public:
 
     WeakPtr& operator=(const WeakPtr& other) {
         if (this != &other) {
-            if (block_) {
-                --block_->weak_cnt;
-                if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                    delete block_;
-                } else if (block_->strong_cnt == 0) {
-                    block_->DeletePtr();
-                }
+            if (other.block_) {
+                Policy::IncWeak(other.block_);
             }
+            Release();
             ptr_ = other.ptr_;
             block_ = other.block_;
-            if (block_) {
-                block_->weak_cnt++;
-            }
         }
         return *this;
     };
 
     WeakPtr& operator=(WeakPtr&& other) {
         if (this != &other) {
-            if (block_) {
-                --block_->weak_cnt;
-                if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                    delete block_;
-                } else if (block_->strong_cnt == 0) {
-                    block_->DeletePtr();
-                }
-            }
+            Release();
             block_ = other.block_;
             other.block_ = nullptr;
             ptr_ = other.ptr_;
@@ -88,28 +76,14 @@ public:
     // Destructor
 
     ~WeakPtr() {
-        if (block_) {
-            --block_->weak_cnt;
-            if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                delete block_;
-            } else if (block_->strong_cnt == 0) {
-                block_->DeletePtr();
-            }
-        }
+        Release();
     };
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Modifiers
 
     void Reset() {
-        if (block_) {
-            --block_->weak_cnt;
-            if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                delete block_;
-            } else if (block_->strong_cnt == 0) {
-                block_->DeletePtr();
-            }
-        }
+        Release();
         block_ = nullptr;
         ptr_ = nullptr;
     };
@@ -123,33 +97,35 @@ public:
 
     size_t UseCount() const {
         if (block_) {
-            return block_->strong_cnt;
+            return Policy::UseCount(block_);
         }
         return 0;
     };
     bool Expired() const {
-        if (block_) {
-            if (block_->strong_cnt > 0) {
-                return false;
-            }
-        }
-        return true;
+        return UseCount() == 0;
     };
-    SharedPtr<T> Lock() const {
-        if (block_) {
-            if (block_->strong_cnt > 0) {
-                return SharedPtr<T>(block_, ptr_);
-            } else {
-                return SharedPtr<T>(block_, nullptr);
-            }
+    SharedPtr<T, Policy> Lock() const {
+        SharedPtr<T, Policy> result;
+        if (block_ && Policy::TryIncStrong(block_)) {
+            result.block_ = block_;
+            result.ptr_ = ptr_;
         }
-        return SharedPtr<T>(block_, ptr_);
+        return result;
     };
 
 private:
+    // Drops the weak reference held by `*this`
+    void Release() {
+        if (block_ && Policy::DecWeak(block_)) {
+            block_->Destroy();
+        }
+    }
+
     ControlBlockBase* block_ = nullptr;
-    T* ptr_ = nullptr;
+    ElementType* ptr_ = nullptr;
 
-    template <typename Y>
+    template <typename Y, typename P>
     friend class SharedPtr;
+    template <typename Pointer>
+    friend struct AtomicCellRefs;
 };
@@ -0,0 +1,225 @@
+#pragma once
+
+#include "../shared-from-this/shared.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Slot map with generational handles
+//
+// Values live in one contiguous array of slots. A `Handle<T>` is a 32-bit slot index plus the
+// 32-bit generation the slot had when the value was inserted: eight bytes, nothing allocated and
+// no pointer to chase. Erasing a value bumps the generation of its slot, so every handle to it
+// goes stale and `Get` returns nullptr for it, even after the slot is reused.
+//
+// The generation is odd while a slot is occupied. A slot whose generation would wrap around is
+// never reused, so a stale handle can never match again.
+//
+// Pointers returned by `Get` are invalidated by the next `Insert` (the array may grow), handles
+// are not.
+//
+// A `SlotMap<SharedPtr<U>>` replaces a set of WeakPtr<U>: the map holds the owners, and
+// `Lock(handle)` hands out a SharedPtr<U> like `WeakPtr::Lock` would.
+
+template <typename T>
+struct Handle {
+    uint32_t index = 0;
+    // 0 is never the generation of an occupied slot, so a default handle is always stale
+    uint32_t generation = 0;
+};
+
+template <typename T>
+inline bool operator==(Handle<T> left, Handle<T> right) {
+    return left.index == right.index && left.generation == right.generation;
+}
+
+template <typename T>
+inline bool operator!=(Handle<T> left, Handle<T> right) {
+    return !(left == right);
+}
+
+template <typename T>
+inline constexpr bool kIsSharedPtr = false;
+
+template <typename T, typename Policy>
+inline constexpr bool kIsSharedPtr<SharedPtr<T, Policy>> = true;
+
+template <typename T>
+class SlotMap {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    SlotMap() = default;
+
+    SlotMap(const SlotMap&) = delete;
+    SlotMap& operator=(const SlotMap&) = delete;
+
+    // The moved-from map is left empty
+    SlotMap(SlotMap&& other) noexcept
+        : slots_(std::move(other.slots_)),
+          free_head_(std::exchange(other.free_head_, kNone)),
+          size_(std::exchange(other.size_, 0)) {
+        other.slots_.clear();
+    }
+
+    SlotMap& operator=(SlotMap&& other) noexcept {
+        if (this != &other) {
+            slots_ = std::move(other.slots_);
+            other.slots_.clear();
+            free_head_ = std::exchange(other.free_head_, kNone);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    template <typename... Args>
+    Handle<T> Emplace(Args&&... args) {
+        uint32_t index;
+        if (free_head_ != kNone) {
+            index = free_head_;
+            Slot& slot = slots_[index];
+            // Shares the storage with the value, which may clobber it before throwing. The slot
+            // leaves the free list only once the value is there.
+            uint32_t next_free = slot.next_free;
+            try {
+                ::new (&slot.value) T(std::forward<Args>(args)...);
+            } catch (...) {
+                slot.next_free = next_free;
+                throw;
+            }
+            free_head_ = next_free;
+            ++slot.generation;
+        } else {
+            index = static_cast<uint32_t>(slots_.size());
+            slots_.emplace_back();
+            Slot& slot = slots_.back();
+            try {
+                ::new (&slot.value) T(std::forward<Args>(args)...);
+            } catch (...) {
+                slots_.pop_back();
+                throw;
+            }
+            slot.generation = 1;
+        }
+        ++size_;
+        return Handle<T>{index, slots_[index].generation};
+    }
+
+    Handle<T> Insert(T value) {
+        return Emplace(std::move(value));
+    }
+
+    // Returns false for a stale handle
+    bool Erase(Handle<T> handle) {
+        if (!Contains(handle)) {
+            return false;
+        }
+        Slot& slot = slots_[handle.index];
+        slot.value.~T();
+        ++slot.generation;
+        // The next round would wrap around to generations old handles may still have: such a slot
+        // is leaked instead
+        if (slot.generation != UINT32_MAX - 1) {
+            slot.next_free = free_head_;
+            free_head_ = handle.index;
+        }
+        --size_;
+        return true;
+    }
+
+    void Clear() {
+        for (uint32_t index = 0; index < slots_.size(); ++index) {
+            if (slots_[index].Occupied()) {
+                Erase(Handle<T>{index, slots_[index].generation});
+            }
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    bool Contains(Handle<T> handle) const {
+        return handle.index < slots_.size() && slots_[handle.index].generation == handle.generation &&
+               slots_[handle.index].Occupied();
+    }
+
+    // nullptr for a stale handle
+    T* Get(Handle<T> handle) {
+        return Contains(handle) ? &slots_[handle.index].value : nullptr;
+    }
+
+    const T* Get(Handle<T> handle) const {
+        return Contains(handle) ? &slots_[handle.index].value : nullptr;
+    }
+
+    // `SlotMap<SharedPtr<U>>` only: an owner of the value, or an empty pointer for a stale handle
+    template <typename Pointer = T>
+    std::enable_if_t<kIsSharedPtr<Pointer>, Pointer> Lock(Handle<T> handle) const {
+        auto value = Get(handle);
+        return value ? *value : Pointer();
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    // Calls `callback(handle, value)` for every value, in slot order
+    template <typename Callback>
+    void ForEach(Callback callback) {
+        for (uint32_t index = 0; index < slots_.size(); ++index) {
+            if (slots_[index].Occupied()) {
+                callback(Handle<T>{index, slots_[index].generation}, slots_[index].value);
+            }
+        }
+    }
+
+private:
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    struct Slot {
+        Slot() {
+        }
+
+        // Only called while the array grows
+        Slot(Slot&& other) noexcept(std::is_nothrow_move_constructible_v<T>)
+            : generation(other.generation) {
+            if (other.Occupied()) {
+                ::new (&value) T(std::move(other.value));
+            } else {
+                next_free = other.next_free;
+            }
+        }
+
+        ~Slot() {
+            if (Occupied()) {
+                value.~T();
+            }
+        }
+
+        bool Occupied() const {
+            return generation & 1;
+        }
+
+        uint32_t generation = 0;
+        union {
+            T value;
+            uint32_t next_free;
+        };
+    };
+
+    std::vector<Slot> slots_;
+    uint32_t free_head_ = kNone;
+    size_t size_ = 0;
+};
@@ -33,7 +33,10 @@ struct CommpressedPairElement<T, I, true> : public T {
     CommpressedPairElement() {
     }
 
-    CommpressedPairElement(const T& val) {
+    CommpressedPairElement(const T& val) : T(val) {
+    }
+
+    CommpressedPairElement(T&& val) : T(std::move(val)) {
     }
 
     T& GetElement() {
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "compressed_pair.h"
+#include "unique.h"
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Owning polymorphic box with a small buffer
+//
+// InlineBox<Shape> shape = MakeInlineBox<Shape, Circle>(1.0);
+// shape->Area();
+//
+// A derived object that fits in N bytes, needs no stricter alignment than the buffer and moves
+// without throwing is constructed inside the box; anything else goes to the heap, as
+// `UniquePtr<Base>` would put it. Either way the box deletes the object as its real type (no
+// virtual destructor needed). A box made from a `UniquePtr<Derived, Deleter>` keeps the deleter
+// with the pointer and deletes the object with it; a deleter that does not fit in the buffer
+// next to the pointer costs one more allocation. Moving a box moves an inline object into the
+// new buffer and only hands a heap pointer over.
+//
+// Accessing the object costs no more than through UniquePtr: the box keeps the base pointer next
+// to the buffer.
+
+template <typename Base, size_t N = 48, size_t Align = alignof(std::max_align_t)>
+class InlineBox {
+    static_assert(N >= sizeof(void*) && Align >= alignof(void*),
+                  "the buffer holds the pointer to a heap object");
+
+public:
+    // Whether `Derived` would be stored in the buffer
+    template <typename Derived>
+    static constexpr bool kFitsInline = sizeof(Derived) <= N && Align % alignof(Derived) == 0 &&
+                                        std::is_nothrow_move_constructible_v<Derived>;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    InlineBox() {
+    }
+    InlineBox(std::nullptr_t) {
+    }
+
+    // Takes over a heap object and its deleter
+    template <typename Derived, typename Deleter,
+              typename = std::enable_if_t<std::is_convertible_v<Derived*, Base*>>>
+    InlineBox(UniquePtr<Derived, Deleter>&& other) {
+        if (other) {
+            using Held = Holder<Derived, Deleter>;
+            if constexpr (kFitsInline<Held>) {
+                ::new (storage_) Held(other.Get(), std::move(other.GetDeleter()));
+                ops_ = &kHeapOps<Derived, Deleter>;
+            } else {
+                ::new (storage_) Held*(new Held(other.Get(), std::move(other.GetDeleter())));
+                ops_ = &kHeldOnHeapOps<Derived, Deleter>;
+            }
+            ptr_ = other.Release();
+        }
+    }
+
+    InlineBox(InlineBox&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    InlineBox(const InlineBox&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    InlineBox& operator=(InlineBox&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    InlineBox& operator=(std::nullptr_t) {
+        Reset();
+        return *this;
+    }
+
+    InlineBox& operator=(const InlineBox&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~InlineBox() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // Destroys the current object first
+    template <typename Derived, typename... Args>
+    Derived& Emplace(Args&&... args) {
+        static_assert(std::is_convertible_v<Derived*, Base*>, "Derived must derive from Base");
+        Reset();
+        Derived* object;
+        if constexpr (kFitsInline<Derived>) {
+            object = ::new (storage_) Derived(std::forward<Args>(args)...);
+            ops_ = &kInlineOps<Derived>;
+        } else {
+            using Held = Holder<Derived, DefaultDeleter<Derived>>;
+            object = new Derived(std::forward<Args>(args)...);
+            ::new (storage_) Held(object, DefaultDeleter<Derived>());
+            ops_ = &kHeapOps<Derived, DefaultDeleter<Derived>>;
+        }
+        ptr_ = object;
+        return *object;
+    }
+
+    void Reset() {
+        if (ops_) {
+            auto ops = ops_;
+            ptr_ = nullptr;
+            ops_ = nullptr;
+            ops->destroy(storage_);
+        }
+    }
+
+    void Swap(InlineBox& other) {
+        InlineBox tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    Base* Get() const {
+        return ptr_;
+    }
+
+    Base& operator*() const {
+        return *ptr_;
+    }
+
+    Base* operator->() const {
+        return ptr_;
+    }
+
+    explicit operator bool() const {
+        return ptr_;
+    }
+
+    bool IsInline() const {
+        return ops_ && ops_->inline_storage;
+    }
+
+private:
+    // What the box needs to know about the real type, one static table per type and placement
+    struct Ops {
+        void (*destroy)(void* storage);
+        // Moves the object (or the heap pointer) into `to`, leaving `from` empty
+        Base* (*relocate)(void* from, void* to);
+        bool inline_storage;
+    };
+
+    template <typename Derived>
+    static constexpr Ops kInlineOps = {
+        [](void* storage) { std::launder(static_cast<Derived*>(storage))->~Derived(); },
+        [](void* from, void* to) -> Base* {
+            auto object = std::launder(static_cast<Derived*>(from));
+            auto moved = ::new (to) Derived(std::move(*object));
+            object->~Derived();
+            return moved;
+        },
+        true};
+
+    // A heap object with its deleter. With an empty deleter this is just the pointer.
+    template <typename Derived, typename Deleter>
+    using Holder = CompressedPair<Derived*, Deleter>;
+
+    // The holder is in the buffer
+    template <typename Derived, typename Deleter>
+    static constexpr Ops kHeapOps = {
+        [](void* storage) {
+            auto holder = std::launder(static_cast<Holder<Derived, Deleter>*>(storage));
+            holder->GetSecond()(holder->GetFirst());
+            std::destroy_at(holder);
+        },
+        [](void* from, void* to) -> Base* {
+            auto holder = std::launder(static_cast<Holder<Derived, Deleter>*>(from));
+            auto moved = ::new (to) Holder<Derived, Deleter>(std::move(*holder));
+            std::destroy_at(holder);
+            return moved->GetFirst();
+        },
+        false};
+
+    // The deleter is too large for the buffer, the holder is allocated and the buffer points to it
+    template <typename Derived, typename Deleter>
+    static constexpr Ops kHeldOnHeapOps = {
+        [](void* storage) {
+            auto holder = *std::launder(static_cast<Holder<Derived, Deleter>**>(storage));
+            holder->GetSecond()(holder->GetFirst());
+            delete holder;
+        },
+        [](void* from, void* to) -> Base* {
+            auto holder = *std::launder(static_cast<Holder<Derived, Deleter>**>(from));
+            ::new (to) Holder<Derived, Deleter>*(holder);
+            return holder->GetFirst();
+        },
+        false};
+
+    void MoveFrom(InlineBox& other) noexcept {
+        if (other.ops_) {
+            ptr_ = other.ops_->relocate(other.storage_, storage_);
+            ops_ = other.ops_;
+            other.ptr_ = nullptr;
+            other.ops_ = nullptr;
+        }
+    }
+
+    alignas(Align) unsigned char storage_[N];
+    Base* ptr_ = nullptr;
+    const Ops* ops_ = nullptr;
+};
+
+template <typename Base, typename Derived, size_t N = 48, size_t Align = alignof(std::max_align_t),
+          typename... Args>
+InlineBox<Base, N, Align> MakeInlineBox(Args&&... args) {
+    InlineBox<Base, N, Align> box;
+    box.template Emplace<Derived>(std::forward<Args>(args)...);
+    return box;
+};
@@ -0,0 +1,248 @@
+#pragma once
+
+#include "unique.h"
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Recycling pool of identical objects, handed out as UniquePtr
+//
+// auto request = ObjectPool<Request>::Acquire(...);  // UniquePtr<Request, PoolDeleter<Request>>
+//
+// A pool is global per (T, Tag), so `PoolDeleter` is an empty type and the UniquePtr stays one
+// pointer wide. Use a distinct Tag for a separate pool of the same type.
+//
+// Every thread keeps a small cache of free slots and returns objects into its own cache, so
+// neither acquiring nor returning touches shared state most of the time. A cache that grows past
+// kCacheMax (objects made in one thread and freed in another) hands half of it to the shared
+// stack, which any thread takes over in a single exchange once its cache runs dry. Both sides are
+// lock-free and ABA-free: pushes are CAS loops, and the stack is only ever emptied as a whole.
+//
+// A type with `void ResetForReuse()` is not destroyed on return: the pool calls that instead and
+// `Acquire()` without arguments hands the object out again as it is.
+//
+// Slots are never given back to the system.
+
+template <typename T, typename = void>
+inline constexpr bool kHasResetForReuse = false;
+
+template <typename T>
+inline constexpr bool kHasResetForReuse<T, std::void_t<decltype(std::declval<T&>().ResetForReuse())>> =
+    true;
+
+template <typename T, typename Tag = void>
+class ObjectPool;
+
+template <typename T, typename Tag = void>
+struct PoolDeleter {
+    void operator()(T* ptr) const {
+        if (ptr) {
+            ObjectPool<T, Tag>::Return(ptr);
+        }
+    }
+};
+
+template <typename T, typename Tag>
+class ObjectPool {
+public:
+    using Pointer = UniquePtr<T, PoolDeleter<T, Tag>>;
+
+    // Summed over all threads. A thread adds its share every kStatsBatch operations and when it
+    // exits, so the numbers lag behind a little.
+    struct Stats {
+        size_t hits;
+        size_t misses;
+        size_t returns;
+
+        double HitRate() const {
+            return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses);
+        }
+    };
+
+    template <typename... Args>
+    static Pointer Acquire(Args&&... args) {
+        Slot* slot = Pop();
+        bool hit = slot;
+        if (!slot) {
+            slot = new Slot;
+        }
+        T* object = Object(slot);
+        if (!hit || !kReuse || sizeof...(Args) > 0) {
+            if (hit && kReuse) {
+                object->~T();
+            }
+            try {
+                ::new (object) T(std::forward<Args>(args)...);
+            } catch (...) {
+                // The slot goes back empty, which a reusing pool cannot tell apart
+                if constexpr (kReuse) {
+                    delete slot;
+                } else {
+                    Push(slot);
+                }
+                throw;
+            }
+        }
+        Count(hit ? &Cache::hits : &Cache::misses);
+        return Pointer(object);
+    }
+
+    static Stats GetStats() {
+        Shared& shared = GetShared();
+        return {shared.hits.load(std::memory_order_relaxed),
+                shared.misses.load(std::memory_order_relaxed),
+                shared.returns.load(std::memory_order_relaxed)};
+    }
+
+private:
+    static constexpr bool kReuse = kHasResetForReuse<T>;
+    static constexpr size_t kCacheMax = 256;
+    static constexpr size_t kStatsBatch = 1024;
+
+    struct Slot {
+        Slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    struct Cache {
+        Slot* head = nullptr;
+        size_t size = 0;
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t returns = 0;
+        size_t pending = 0;
+    };
+
+    struct Shared {
+        std::atomic<Slot*> free{nullptr};
+        std::atomic<size_t> hits{0};
+        std::atomic<size_t> misses{0};
+        std::atomic<size_t> returns{0};
+    };
+
+    struct CacheHolder {
+        ~CacheHolder() {
+            cache = nullptr;
+            FlushStats(local);
+            if (local.head) {
+                PushChain(local.head, Last(local.head));
+            }
+        }
+
+        Cache local;
+        Cache* cache = &local;
+    };
+
+    static void Return(T* object) {
+        if constexpr (kReuse) {
+            object->ResetForReuse();
+        } else {
+            object->~T();
+        }
+        Push(reinterpret_cast<Slot*>(reinterpret_cast<unsigned char*>(object) -
+                                     offsetof(Slot, storage)));
+        Count(&Cache::returns);
+    }
+
+    static T* Object(Slot* slot) {
+        return std::launder(reinterpret_cast<T*>(slot->storage));
+    }
+
+    static Slot* Pop() {
+        Cache* cache = LocalCache();
+        if (!cache) {
+            Slot* head = GetShared().free.exchange(nullptr, std::memory_order_acquire);
+            if (head && head->next) {
+                PushChain(head->next, Last(head->next));
+            }
+            return head;
+        }
+        if (!cache->head) {
+            cache->head = GetShared().free.exchange(nullptr, std::memory_order_acquire);
+            for (Slot* slot = cache->head; slot; slot = slot->next) {
+                ++cache->size;
+            }
+            if (!cache->head) {
+                return nullptr;
+            }
+        }
+        Slot* slot = cache->head;
+        cache->head = slot->next;
+        --cache->size;
+        return slot;
+    }
+
+    static void Push(Slot* slot) {
+        Cache* cache = LocalCache();
+        if (!cache) {
+            PushChain(slot, slot);
+            return;
+        }
+        slot->next = cache->head;
+        cache->head = slot;
+        if (++cache->size <= kCacheMax) {
+            return;
+        }
+        // Keep the most recently used half
+        Slot* last = cache->head;
+        for (size_t i = 1; i < kCacheMax / 2; ++i) {
+            last = last->next;
+        }
+        Slot* rest = last->next;
+        last->next = nullptr;
+        cache->size = kCacheMax / 2;
+        PushChain(rest, Last(rest));
+    }
+
+    static void PushChain(Slot* first, Slot* last) {
+        std::atomic<Slot*>& free = GetShared().free;
+        Slot* head = free.load(std::memory_order_relaxed);
+        do {
+            last->next = head;
+        } while (!free.compare_exchange_weak(head, first, std::memory_order_release,
+                                             std::memory_order_relaxed));
+    }
+
+    static Slot* Last(Slot* slot) {
+        while (slot->next) {
+            slot = slot->next;
+        }
+        return slot;
+    }
+
+    static void Count(size_t Cache::*counter) {
+        Cache* cache = LocalCache();
+        if (!cache) {
+            return;
+        }
+        ++(cache->*counter);
+        if (++cache->pending == kStatsBatch) {
+            FlushStats(*cache);
+        }
+    }
+
+    static void FlushStats(Cache& cache) {
+        Shared& shared = GetShared();
+        shared.hits.fetch_add(cache.hits, std::memory_order_relaxed);
+        shared.misses.fetch_add(cache.misses, std::memory_order_relaxed);
+        shared.returns.fetch_add(cache.returns, std::memory_order_relaxed);
+        cache.hits = cache.misses = cache.returns = cache.pending = 0;
+    }
+
+    // nullptr while the thread-local cache is being torn down
+    static Cache* LocalCache() {
+        static thread_local CacheHolder holder;
+        return holder.cache;
+    }
+
+    // Leaked on purpose, objects may be returned after static destructors have run
+    static Shared& GetShared() {
+        static auto shared = new Shared;
+        return *shared;
+    }
+
+    friend struct PoolDeleter<T, Tag>;
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "unique.h"
+
+#include <cassert>
+#include <cstddef>  // std::nullptr_t
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+// UniquePtr with a small tag packed into the bits of the pointer that are always zero
+//
+// TaggedUniquePtr<Node, 2> child(new Node, kRed);  // sizeof(child) == sizeof(Node*)
+//
+// The low log2(alignof(T)) bits of an aligned pointer are zero. On x86-64 user-space addresses
+// are canonical with the top 16 bits clear as well (a 5-level page table only hands out higher
+// addresses when asked for them), so up to 16 more tag bits go there. Define
+// SMART_POINTERS_NO_HIGH_TAG_BITS to keep to the alignment bits. Asking for more bits than the
+// type leaves free is a compile error.
+//
+// The deleter is kept the way UniquePtr keeps it, so an empty one costs nothing. It is called
+// with the plain pointer. `Release` and `Reset` leave the tag alone.
+
+#if defined(__x86_64__) && !defined(SMART_POINTERS_NO_HIGH_TAG_BITS)
+inline constexpr int kTagHighBits = 16;
+#else
+inline constexpr int kTagHighBits = 0;
+#endif
+
+template <typename T, int Bits, typename Deleter = DefaultDeleter<T>>
+class TaggedUniquePtr {
+    static_assert(!std::is_array_v<T>, "TaggedUniquePtr owns single objects only");
+
+    static constexpr int Log2(size_t value) {
+        return value <= 1 ? 0 : 1 + Log2(value / 2);
+    }
+
+    static constexpr int kLowBits = Log2(alignof(T)) < Bits ? Log2(alignof(T)) : Bits;
+    static constexpr int kHighBits = Bits - kLowBits;
+    static constexpr int kHighShift = 64 - kTagHighBits;
+
+    static_assert(Bits >= 0 && kHighBits <= kTagHighBits,
+                  "T is not aligned enough to hold that many tag bits");
+
+    static constexpr uintptr_t kLowMask = (uintptr_t(1) << kLowBits) - 1;
+    static constexpr uintptr_t kHighMask =
+        kHighBits == 0 ? 0 : ((uintptr_t(1) << kHighBits) - 1) << kHighShift;
+    static constexpr uintptr_t kTagMask = kLowMask | kHighMask;
+
+public:
+    static constexpr int kTagBits = Bits;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    explicit TaggedUniquePtr(T* ptr = nullptr, uintptr_t tag = 0)
+        : pair_(Pack(ptr, tag), Deleter()){};
+
+    TaggedUniquePtr(T* ptr, Deleter deleter, uintptr_t tag = 0)
+        : pair_(Pack(ptr, tag), std::move(deleter)){};
+
+    TaggedUniquePtr(TaggedUniquePtr&& other) noexcept
+        : pair_(other.pair_.GetFirst(), std::move(other.pair_.GetSecond())) {
+        other.pair_.GetFirst() &= kTagMask;
+    };
+
+    TaggedUniquePtr(TaggedUniquePtr& other) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    TaggedUniquePtr& operator=(TaggedUniquePtr&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            pair_.GetFirst() = other.pair_.GetFirst();
+            other.pair_.GetFirst() &= kTagMask;
+            GetDeleter() = std::move(other.GetDeleter());
+        }
+        return *this;
+    };
+
+    TaggedUniquePtr& operator=(std::nullptr_t) {
+        Reset();
+        return *this;
+    };
+
+    TaggedUniquePtr& operator=(TaggedUniquePtr& other) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~TaggedUniquePtr() {
+        if (auto ptr = Get()) {
+            pair_.GetSecond()(ptr);
+        }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    T* Release() {
+        auto tmp = Get();
+        pair_.GetFirst() &= kTagMask;
+        return tmp;
+    };
+
+    void Reset(T* ptr = nullptr) {
+        auto tmp = Get();
+        pair_.GetFirst() = Pack(ptr, GetTag());
+        if (tmp) {
+            pair_.GetSecond()(tmp);
+        }
+    };
+
+    void Swap(TaggedUniquePtr& other) {
+        std::swap(pair_.GetFirst(), other.pair_.GetFirst());
+        std::swap(pair_.GetSecond(), other.pair_.GetSecond());
+    };
+
+    void SetTag(uintptr_t tag) {
+        pair_.GetFirst() = Pack(Get(), tag);
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return reinterpret_cast<T*>(pair_.GetFirst() & ~kTagMask);
+    };
+    uintptr_t GetTag() const {
+        uintptr_t word = pair_.GetFirst();
+        if constexpr (kHighBits == 0) {
+            return word & kLowMask;
+        } else {
+            return (word & kLowMask) | ((word & kHighMask) >> kHighShift << kLowBits);
+        }
+    };
+    Deleter& GetDeleter() {
+        return (pair_.GetSecond());
+    };
+    const Deleter& GetDeleter() const {
+        return (pair_.GetSecond());
+    };
+    explicit operator bool() const {
+        return Get();
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Single-object dereference operators
+
+    std::add_lvalue_reference_t<T> operator*() const {
+        return *Get();
+    };
+
+    T* operator->() const {
+        return Get();
+    };
+
+private:
+    static uintptr_t Pack(T* ptr, uintptr_t tag) {
+        auto word = reinterpret_cast<uintptr_t>(ptr);
+        assert((word & kTagMask) == 0 && "pointer uses the bits reserved for the tag");
+        assert(tag >> Bits == 0 && "tag does not fit");
+        if constexpr (kHighBits == 0) {
+            return word | tag;
+        } else {
+            return word | (tag & kLowMask) | ((tag >> kLowBits) << kHighShift);
+        }
+    }
+
+    CompressedPair<uintptr_t, Deleter> pair_;
+};
@@ -88,9 +88,9 @@ public:
     };
 
     void Reset(T* ptr = nullptr) {
-        if (pair_.GetFirst()) {
-            auto tmp = pair_.GetFirst();
-            pair_.GetFirst() = ptr;
+        auto tmp = pair_.GetFirst();
+        pair_.GetFirst() = ptr;
+        if (tmp) {
             pair_.GetSecond()(tmp);
         }
     };
@@ -135,23 +135,85 @@ private:
 template <typename T, typename Deleter>
 class UniquePtr<T[], Deleter> {
 public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
     explicit UniquePtr(T* ptr = nullptr) : pair_(ptr, Deleter()){};
 
-    void Reset(T* ptr = nullptr) {
+    UniquePtr(T* ptr, Deleter deleter) : pair_(ptr, std::move(deleter)){};
+
+    UniquePtr(UniquePtr&& other) noexcept
+        : pair_(other.Release(), std::move(other.pair_.GetSecond())){};
+
+    UniquePtr(UniquePtr& other) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    UniquePtr& operator=(UniquePtr&& other) noexcept {
+        if (this != &other) {
+            Reset(other.Release());
+            GetDeleter() = std::move(other.GetDeleter());
+        }
+        return *this;
+    };
+
+    UniquePtr& operator=(std::nullptr_t) {
+        Reset();
+        return *this;
+    };
+
+    UniquePtr& operator=(UniquePtr& other) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~UniquePtr() {
         if (pair_.GetFirst()) {
-            auto tmp = pair_.GetFirst();
-            pair_.GetFirst() = ptr;
+            pair_.GetSecond()(pair_.GetFirst());
+        }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    T* Release() {
+        auto tmp = pair_.GetFirst();
+        pair_.GetFirst() = nullptr;
+        return tmp;
+    };
+
+    void Reset(T* ptr = nullptr) {
+        auto tmp = pair_.GetFirst();
+        pair_.GetFirst() = ptr;
+        if (tmp) {
             pair_.GetSecond()(tmp);
         }
     };
 
-    ~UniquePtr() {
-        pair_.GetSecond()(pair_.GetFirst());
+    void Swap(UniquePtr& other) {
+        std::swap(pair_.GetFirst(), other.pair_.GetFirst());
+        std::swap(pair_.GetSecond(), other.pair_.GetSecond());
     };
 
-    T& operator[](size_t i) {
-        return pair_.GetFirst()[i];
-    }
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return pair_.GetFirst();
+    };
+    Deleter& GetDeleter() {
+        return (pair_.GetSecond());
+    };
+    const Deleter& GetDeleter() const {
+        return (pair_.GetSecond());
+    };
+    explicit operator bool() const {
+        return pair_.GetFirst();
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Array access
 
     T& operator[](size_t i) const {
         return pair_.GetFirst()[i];
@@ -160,3 +222,28 @@ public:
 private:
     CompressedPair<T*, Deleter> pair_;
 };
+
+template <typename T>
+inline constexpr bool kIsUniqueUnboundedArray = std::is_array_v<T> && std::extent_v<T> == 0;
+
+template <typename T, typename... Args>
+std::enable_if_t<!std::is_array_v<T>, UniquePtr<T>> MakeUnique(Args&&... args) {
+    return UniquePtr<T>(new T(std::forward<Args>(args)...));
+};
+
+// `n` value-initialized elements: zeroes for trivial types
+template <typename T>
+std::enable_if_t<kIsUniqueUnboundedArray<T>, UniquePtr<T>> MakeUnique(size_t n) {
+    return UniquePtr<T>(new std::remove_extent_t<T>[n]());
+};
+
+// Default-initialized: trivial types are left as they are, for buffers about to be overwritten
+template <typename T>
+std::enable_if_t<!std::is_array_v<T>, UniquePtr<T>> MakeUniqueForOverwrite() {
+    return UniquePtr<T>(new T);
+};
+
+template <typename T>
+std::enable_if_t<kIsUniqueUnboundedArray<T>, UniquePtr<T>> MakeUniqueForOverwrite(size_t n) {
+    return UniquePtr<T>(new std::remove_extent_t<T>[n]);
+};
@@ -3,6 +3,7 @@
 #include "sw_fwd.h"
 // #include "weak.h" // Forward declaration
 
+#include <atomic>
 #include <cstddef>  // std::nullptr_t
 #include <type_traits>
 #include <memory>
@@ -10,28 +11,112 @@
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
 
 struct ControlBlockBase {
-    size_t strong_cnt = 1;
-    size_t weak_cnt = 0;
-    bool ptr_deleted = false;
+    // All strong references together hold one weak reference, so the object is destroyed
+    // exactly once (when `strong_cnt` drops to zero) and the block itself when `weak_cnt` does
+    std::atomic<size_t> strong_cnt{1};
+    std::atomic<size_t> weak_cnt{1};
     virtual void DeletePtr() = 0;
     virtual ~ControlBlockBase() = default;
 };
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reference counting policies
+//
+// A policy is the second template argument of SharedPtr/WeakPtr and decides how the counts of
+// ControlBlockBase are touched. `DecStrong`/`DecWeak` return true for the last reference.
+
+// Shared ownership never leaves one thread: relaxed loads and stores compile to plain memory
+// accesses, without a single locked instruction
+struct NonAtomicRefCount {
+    static void IncStrong(ControlBlockBase* block) {
+        Add(block->strong_cnt, 1);
+    }
+
+    static bool TryIncStrong(ControlBlockBase* block) {
+        if (block->strong_cnt.load(std::memory_order_relaxed) == 0) {
+            return false;
+        }
+        Add(block->strong_cnt, 1);
+        return true;
+    }
+
+    static bool DecStrong(ControlBlockBase* block) {
+        return Add(block->strong_cnt, -1) == 0;
+    }
+
+    static void IncWeak(ControlBlockBase* block) {
+        Add(block->weak_cnt, 1);
+    }
+
+    static bool DecWeak(ControlBlockBase* block) {
+        return Add(block->weak_cnt, -1) == 0;
+    }
+
+    static size_t UseCount(const ControlBlockBase* block) {
+        return block->strong_cnt.load(std::memory_order_relaxed);
+    }
+
+private:
+    static size_t Add(std::atomic<size_t>& cnt, size_t delta) {
+        size_t value = cnt.load(std::memory_order_relaxed) + delta;
+        cnt.store(value, std::memory_order_relaxed);
+        return value;
+    }
+};
+
+// Default policy: pointers to one object may be copied and destroyed from any thread
+struct AtomicRefCount {
+    // A new reference is always made from an existing one, nothing to synchronize with
+    static void IncStrong(ControlBlockBase* block) {
+        block->strong_cnt.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // `WeakPtr::Lock`: never bring back an object whose count has already reached zero
+    static bool TryIncStrong(ControlBlockBase* block) {
+        size_t cnt = block->strong_cnt.load(std::memory_order_relaxed);
+        while (cnt != 0) {
+            if (block->strong_cnt.compare_exchange_weak(cnt, cnt + 1, std::memory_order_acq_rel,
+                                                        std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Every write to the object happens before its destruction in the thread that drops the
+    // last reference
+    static bool DecStrong(ControlBlockBase* block) {
+        return Release(block->strong_cnt);
+    }
+
+    static void IncWeak(ControlBlockBase* block) {
+        block->weak_cnt.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static bool DecWeak(ControlBlockBase* block) {
+        return Release(block->weak_cnt);
+    }
+
+    // Acquire, so that `UseCount() == 1` can be trusted as "nobody else touches the object"
+    static size_t UseCount(const ControlBlockBase* block) {
+        return block->strong_cnt.load(std::memory_order_acquire);
+    }
+
+private:
+    // acq_rel instead of release plus an acquire fence on the last reference: the same code on
+    // x86, and ThreadSanitizer does not understand fences
+    static bool Release(std::atomic<size_t>& cnt) {
+        return cnt.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+};
+
 template <typename T>
 struct ControlBlockPointer : public ControlBlockBase {
     explicit ControlBlockPointer(T* ptr) : ptr_(ptr){};
     T* ptr_;
 
     void DeletePtr() override {
-        if (!ptr_deleted) {
-            delete ptr_;
-            ptr_deleted = true;
-        }
-    }
-    ~ControlBlockPointer() override {
-        if (!ptr_deleted) {
-            delete ptr_;
-        }
+        delete ptr_;
     }
 };
 
@@ -43,21 +128,13 @@ struct ControlBlockEmplace : public ControlBlockBase {
     };
 
     void DeletePtr() override {
-        if (!ptr_deleted) {
-            std::destroy_at(std::launder(reinterpret_cast<T*>(&storage_)));
-            ptr_deleted = true;
-        }
+        std::destroy_at(std::launder(reinterpret_cast<T*>(&storage_)));
     }
 
-    ~ControlBlockEmplace() override {
-        if (!ptr_deleted) {
-            std::destroy_at(std::launder(reinterpret_cast<T*>(&storage_)));
-        }
-    }
     std::aligned_storage_t<sizeof(T), alignof(T)> storage_;
 };
 
-template <typename T>
+template <typename T, typename Policy>
 class SharedPtr {
 public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -80,16 +157,16 @@ public:
     SharedPtr(const SharedPtr& other) {
         block_ = other.block_;
         if (block_) {
-            block_->strong_cnt++;
+            Policy::IncStrong(block_);
         }
         ptr_ = other.ptr_;
     };
 
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other) {
+    SharedPtr(const SharedPtr<Y, Policy>& other) {
         block_ = other.GetBlock();
         if (block_) {
-            block_->strong_cnt++;
+            Policy::IncStrong(block_);
         }
         ptr_ = other.Get();
     };
@@ -102,11 +179,11 @@ public:
     };
 
     template <typename Y>
-    SharedPtr(SharedPtr<Y>&& other) {
-        block_ = other.GetBlock();
-        ptr_ = other.Get();
-        block_->strong_cnt++;
-        other.Reset();
+    SharedPtr(SharedPtr<Y, Policy>&& other) {
+        block_ = other.block_;
+        ptr_ = other.ptr_;
+        other.block_ = nullptr;
+        other.ptr_ = nullptr;
     };
 
     SharedPtr(ControlBlockEmplace<T>* block) {
@@ -117,6 +194,9 @@ public:
     SharedPtr(ControlBlockBase* block, T* ptr) {
         block_ = block;
         ptr_ = ptr;
+        if (block_) {
+            Policy::IncStrong(block_);
+        }
     }
 
     //    template <typename Y>
@@ -128,23 +208,20 @@ public:
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) {
+    SharedPtr(const SharedPtr<Y, Policy>& other, T* ptr) {
         ptr_ = ptr;
         if (other.GetBlock()) {
             block_ = other.GetBlock();
-            block_->strong_cnt++;
+            Policy::IncStrong(block_);
         }
     };
 
     // Promote `WeakPtr`
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
-    explicit SharedPtr(const WeakPtr<T>& other) {
-        if (other.UseCount()) {
+    explicit SharedPtr(const WeakPtr<T, Policy>& other) {
+        if (other.block_ && Policy::TryIncStrong(other.block_)) {
             block_ = other.block_;
             ptr_ = other.ptr_;
-            if (block_) {
-                ++block_->strong_cnt;
-            }
         } else {
             throw BadWeakPtr();
         }
@@ -155,35 +232,19 @@ public:
 
     SharedPtr& operator=(const SharedPtr& other) {
         if (this != &other) {
-            if (block_) {
-                --block_->strong_cnt;
-                if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                    delete block_;
-                } else if (block_->strong_cnt == 0) {
-                    block_->DeletePtr();
-                    ptr_ = nullptr;
-                }
+            if (other.block_) {
+                Policy::IncStrong(other.block_);
             }
+            Release();
             ptr_ = other.ptr_;
             block_ = other.block_;
-            if (block_) {
-                block_->strong_cnt++;
-            }
         }
         return *this;
     };
 
     SharedPtr& operator=(SharedPtr&& other) {
         if (this != &other) {
-            if (block_) {
-                --block_->strong_cnt;
-                if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                    delete block_;
-                } else if (block_->strong_cnt == 0) {
-                    block_->DeletePtr();
-                    ptr_ = nullptr;
-                }
-            }
+            Release();
             block_ = other.block_;
             other.block_ = nullptr;
             ptr_ = other.ptr_;
@@ -196,59 +257,27 @@ public:
     // Destructor
 
     ~SharedPtr() {
-        if (block_) {
-            --block_->strong_cnt;
-            if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                delete block_;
-            } else if (block_->strong_cnt == 0) {
-                block_->DeletePtr();
-                ptr_ = nullptr;
-            }
-        }
+        Release();
     };
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Modifiers
 
     void Reset() {
-        if (block_) {
-            --block_->strong_cnt;
-            if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                delete block_;
-            } else if (block_->strong_cnt == 0) {
-                block_->DeletePtr();
-                ptr_ = nullptr;
-            }
-        }
+        Release();
         block_ = nullptr;
         ptr_ = nullptr;
     };
 
     void Reset(T* ptr) {
-        if (block_) {
-            --block_->strong_cnt;
-            if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                delete block_;
-            } else if (block_->strong_cnt == 0) {
-                block_->DeletePtr();
-                ptr_ = nullptr;
-            }
-        }
+        Release();
         block_ = new ControlBlockPointer<T>(ptr);
         ptr_ = ptr;
     };
 
     template <typename Y>
     void Reset(Y* ptr) {
-        if (block_) {
-            --block_->strong_cnt;
-            if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                delete block_;
-            } else if (block_->strong_cnt == 0) {
-                block_->DeletePtr();
-                ptr_ = nullptr;
-            }
-        }
+        Release();
         block_ = new ControlBlockPointer<Y>(ptr);
         ptr_ = ptr;
     };
@@ -293,7 +322,7 @@ public:
 
     size_t UseCount() const {
         if (block_) {
-            return block_->strong_cnt;
+            return Policy::UseCount(block_);
         }
         return 0;
     };
@@ -303,18 +332,35 @@ public:
     };
 
 private:
+    // Drops the reference held by `*this`, fields are left for the caller to overwrite
+    void Release() {
+        if (block_ && Policy::DecStrong(block_)) {
+            block_->DeletePtr();
+            if (Policy::DecWeak(block_)) {
+                delete block_;
+            }
+        }
+    }
+
     ControlBlockBase* block_ = nullptr;
     T* ptr_ = nullptr;
+
+    template <typename Y, typename P>
+    friend class SharedPtr;
+    template <typename Y, typename P>
+    friend class WeakPtr;
 };
 
-template <typename T, typename U>
-inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right);
+template <typename T, typename U, typename Policy>
+inline bool operator==(const SharedPtr<T, Policy>& left, const SharedPtr<U, Policy>& right) {
+    return left.Get() == right.Get();
+};
 
 // Allocate memory only once
-template <typename T, typename... Args>
-SharedPtr<T> MakeShared(Args&&... args) {
+template <typename T, typename Policy = AtomicRefCount, typename... Args>
+SharedPtr<T, Policy> MakeShared(Args&&... args) {
     auto block = new ControlBlockEmplace<T>(std::forward<Args>(args)...);
-    return SharedPtr<T>(block);
+    return SharedPtr<T, Policy>(block);
 };
 
 // Look for usage examples in tests
@@ -4,8 +4,12 @@
 
 class BadWeakPtr : public std::exception {};
 
-template <typename T>
+// Reference counting policies, see shared.h
+struct AtomicRefCount;
+struct NonAtomicRefCount;
+
+template <typename T, typename Policy = AtomicRefCount>
 class SharedPtr;
 
-template <typename T>
+template <typename T, typename Policy = AtomicRefCount>
 class WeakPtr;
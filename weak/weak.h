@@ -4,7 +4,7 @@
 #include "shared.h"  // Forward declaration
 
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
-template <typename T>
+template <typename T, typename Policy>
 class WeakPtr {
 public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -15,7 +15,7 @@ public:
     WeakPtr(const WeakPtr& other) {
         block_ = other.block_;
         if (block_) {
-            block_->weak_cnt++;
+            Policy::IncWeak(block_);
         }
         ptr_ = other.ptr_;
     };
@@ -28,46 +28,40 @@ public:
 
     // Demote `SharedPtr`
     // #2 from https://en.cppreference.com/w/cpp/memory/weak_ptr/weak_ptr
-    WeakPtr(const SharedPtr<T>& other) {
+    WeakPtr(const SharedPtr<T, Policy>& other) {
         block_ = other.GetBlock();
         if (block_) {
-            block_->weak_cnt++;
+            Policy::IncWeak(block_);
         }
         ptr_ = other.Get();
     };
 
+    WeakPtr(ControlBlockBase* block, T* ptr) {
+        block_ = block;
+        ptr_ = ptr;
+        if (block_) {
+            Policy::IncWeak(block_);
+        }
+    }
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // `operator=`-s
 
     WeakPtr& operator=(const WeakPtr& other) {
         if (this != &other) {
-            if (block_) {
-                --block_->weak_cnt;
-                if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                    delete block_;
-                } else if (block_->strong_cnt == 0) {
-                    block_->DeletePtr();
-                }
+            if (other.block_) {
+                Policy::IncWeak(other.block_);
             }
+            Release();
             ptr_ = other.ptr_;
             block_ = other.block_;
-            if (block_) {
-                block_->weak_cnt++;
-            }
         }
         return *this;
     };
 
     WeakPtr& operator=(WeakPtr&& other) {
         if (this != &other) {
-            if (block_) {
-                --block_->weak_cnt;
-                if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                    delete block_;
-                } else if (block_->strong_cnt == 0) {
-                    block_->DeletePtr();
-                }
-            }
+            Release();
             block_ = other.block_;
             other.block_ = nullptr;
             ptr_ = other.ptr_;
@@ -80,28 +74,14 @@ public:
     // Destructor
 
     ~WeakPtr() {
-        if (block_) {
-            --block_->weak_cnt;
-            if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                delete block_;
-            } else if (block_->strong_cnt == 0) {
-                block_->DeletePtr();
-            }
-        }
+        Release();
     };
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Modifiers
 
     void Reset() {
-        if (block_) {
-            --block_->weak_cnt;
-            if (block_->strong_cnt == 0 && block_->weak_cnt == 0) {
-                delete block_;
-            } else if (block_->strong_cnt == 0) {
-                block_->DeletePtr();
-            }
-        }
+        Release();
         block_ = nullptr;
         ptr_ = nullptr;
     };
@@ -115,35 +95,33 @@ public:
 
     size_t UseCount() const {
         if (block_) {
-            return block_->strong_cnt;
+            return Policy::UseCount(block_);
         }
         return 0;
     };
     bool Expired() const {
-        if (block_) {
-            if (block_->strong_cnt > 0) {
-                return false;
-            }
-        }
-        return true;
+        return UseCount() == 0;
     };
-    SharedPtr<T> Lock() const {
-        if (block_) {
-            if (block_->strong_cnt > 0) {
-                ++block_->strong_cnt;
-                return SharedPtr<T>(block_, ptr_);
-            } else {
-                ++block_->strong_cnt;
-                return SharedPtr<T>(block_, nullptr);
-            }
+    SharedPtr<T, Policy> Lock() const {
+        SharedPtr<T, Policy> result;
+        if (block_ && Policy::TryIncStrong(block_)) {
+            result.block_ = block_;
+            result.ptr_ = ptr_;
         }
-        return SharedPtr<T>(block_, ptr_);
+        return result;
     };
 
 private:
+    // Drops the weak reference held by `*this`
+    void Release() {
+        if (block_ && Policy::DecWeak(block_)) {
+            delete block_;
+        }
+    }
+
     ControlBlockBase* block_ = nullptr;
     T* ptr_ = nullptr;
 
-    template <typename Y>
+    template <typename Y, typename P>
     friend class SharedPtr;
 };